@@ -0,0 +1,35 @@
+#version 400 core
+
+// vertexShader.glsl plus motion evaluated here from uTime, so geometry
+// uploaded once keeps moving without any per-frame uploads.
+layout(location = 0) in vec2 position;
+layout(location = 1) in vec2 texCoord;
+layout(location = 2) in vec4 aColor;
+layout(location = 3) in float aTexIndex;
+layout(location = 4) in vec4 aMotion; // amplitude, frequency (rad/s), phase, easing curve
+
+out vec2 vTexCoord;
+out vec4 vColor;
+out float vTexIndex;
+
+uniform mat4 uMvp;
+uniform float uTime;
+
+// EasingCurve and its CPU version, Ease, in tween.h
+float Ease(float t, int curve) {
+  switch (curve) {
+    case 1: return t * t;
+    case 2: return t * (2.0 - t);
+    case 3: return t < 0.5 ? 4.0 * t * t * t : 1.0 - 4.0 * pow(1.0 - t, 3.0);
+    default: return t;
+  }
+}
+
+void main() {
+  float wave = 0.5 + 0.5 * sin(aMotion.y * uTime + aMotion.z);
+  vec2 moved = position - vec2(0.0, aMotion.x * Ease(wave, int(aMotion.w)));
+  gl_Position = uMvp * vec4(moved, 0.0, 1.0);
+  vTexCoord = texCoord;
+  vColor = aColor;
+  vTexIndex = aTexIndex;
+}
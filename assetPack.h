@@ -0,0 +1,145 @@
+#pragma once
+
+#include "hash.h"
+#include "mappedFile.h"
+
+#include <cstdint>
+#include <span>
+#include <string_view>
+
+// Asset pack layout (all offsets from the start of the file):
+//
+//   AssetPackHeader
+//   AssetPackEntry[entryCount]   sorted by nameHash
+//   names                        entry names, not NUL-terminated
+//   blobs                        each starting on an ASSET_PACK_ALIGNMENT boundary
+//
+// The pack is mapped once at startup; lookups are a binary search over the
+// table of contents and hand out spans into the mapping.
+
+#define ASSET_PACK_MAGIC     0x4b415041u // "APAK"
+#define ASSET_PACK_VERSION   1u
+#define ASSET_PACK_ALIGNMENT 4096u
+
+enum AssetKind : uint32_t {
+    ASSET_RAW   = 0, // file bytes as-is
+    ASSET_IMAGE = 1, // pre-decoded 8-bit pixels, w*h*channels bytes
+};
+
+enum AssetFlags : uint32_t {
+    ASSET_FLIPPED_VERTICALLY = 1 << 0,
+};
+
+struct AssetPackHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t entryCount;
+    uint32_t namesSize;
+    uint64_t tocOffset;
+    uint64_t namesOffset;
+};
+
+struct AssetPackEntry {
+    uint64_t nameHash;
+    uint64_t offset;
+    uint64_t size;
+    uint32_t nameOffset;
+    uint32_t nameLength;
+    uint32_t kind;
+    uint32_t flags;
+    uint32_t w, h;
+    uint32_t channels;
+    uint32_t reserved;
+};
+
+struct AssetPack {
+    MappedFile file;
+    const AssetPackHeader* header = nullptr;
+    const AssetPackEntry* entries = nullptr;
+    const char* names = nullptr;
+};
+
+uint64_t AlignAssetOffset(uint64_t offset) {
+    return (offset + ASSET_PACK_ALIGNMENT - 1) & ~(uint64_t)(ASSET_PACK_ALIGNMENT - 1);
+}
+
+// Whether [offset, offset + size) lies within a file of fileSize bytes.
+bool AssetRangeFits(uint64_t offset, uint64_t size, uint64_t fileSize) {
+    return offset <= fileSize && size <= fileSize - offset;
+}
+
+// Everything the loaders read from an entry lies within the file: its name,
+// its blob and, for images, w*h*channels pixel bytes.
+bool IsValidAssetEntry(AssetPackHeader const& header, AssetPackEntry const& entry, uint64_t fileSize) {
+    if (!AssetRangeFits(entry.nameOffset, entry.nameLength, header.namesSize) || !AssetRangeFits(entry.offset, entry.size, fileSize)) {
+        return false;
+    }
+    return entry.kind != ASSET_IMAGE ||
+           (entry.channels >= 1 && entry.channels <= 4 && (uint64_t)entry.w*entry.h*entry.channels <= entry.size);
+}
+
+// Returns an empty pack when the file does not exist, so callers can always
+// look up the pack first and fall back to the filesystem. Exits on a pack
+// whose table of contents points outside the file.
+AssetPack OpenAssetPack(const char* path) {
+    AssetPack pack;
+    pack.file = MapFile(path, MAP_FILE_RANDOM | MAP_FILE_OPTIONAL);
+    if (!pack.file) {
+        return pack;
+    }
+
+    auto bytes = pack.file.Bytes();
+    auto header = (const AssetPackHeader*)bytes.data();
+    if (bytes.size() < sizeof(AssetPackHeader) || header->magic != ASSET_PACK_MAGIC || header->version != ASSET_PACK_VERSION) {
+        fprintf(stderr, "OpenAssetPack: %s is not a version %u asset pack\n", path, ASSET_PACK_VERSION);
+        exit(1);
+    }
+    if (!AssetRangeFits(header->tocOffset, (uint64_t)header->entryCount*sizeof(AssetPackEntry), bytes.size()) ||
+        !AssetRangeFits(header->namesOffset, header->namesSize, bytes.size())) {
+        fprintf(stderr, "OpenAssetPack: %s is truncated\n", path);
+        exit(1);
+    }
+
+    pack.header = header;
+    pack.entries = (const AssetPackEntry*)(bytes.data() + header->tocOffset);
+    pack.names = (const char*)(bytes.data() + header->namesOffset);
+    for (uint32_t i = 0; i < header->entryCount; ++i) {
+        if (!IsValidAssetEntry(*header, pack.entries[i], bytes.size())) {
+            fprintf(stderr, "OpenAssetPack: %s: entry %u lies outside the file\n", path, i);
+            exit(1);
+        }
+    }
+    return pack;
+}
+
+std::string_view AssetName(AssetPack const& pack, AssetPackEntry const& entry) {
+    return {pack.names + entry.nameOffset, entry.nameLength};
+}
+
+std::span<const unsigned char> AssetBytes(AssetPack const& pack, AssetPackEntry const& entry) {
+    return pack.file.Bytes().subspan(entry.offset, entry.size);
+}
+
+const AssetPackEntry* FindAsset(AssetPack const& pack, std::string_view name) {
+    if (!pack.header) {
+        return nullptr;
+    }
+
+    uint64_t hash = HashString(name);
+    uint32_t lo = 0, hi = pack.header->entryCount;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo)/2;
+        if (pack.entries[mid].nameHash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (uint32_t i = lo; i < pack.header->entryCount && pack.entries[i].nameHash == hash; ++i) {
+        if (AssetName(pack, pack.entries[i]) == name) {
+            return &pack.entries[i];
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,538 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Block-compressed textures. texconv encodes RGBA8 images into one of the
+// formats below and writes them to a .ctex container; ReadImage recognizes the
+// container and LoadGlTexture uploads the blocks with glCompressedTexImage2D.
+//
+// .ctex layout:
+//
+//   CompressedTextureHeader
+//   CompressedTextureLevel[levels]  largest first
+//   block data                      16-byte aligned, levels back to back
+
+#define COMPRESSED_TEXTURE_MAGIC   0x58455443u // "CTEX"
+#define COMPRESSED_TEXTURE_VERSION 1u
+
+enum BlockFormat : uint32_t {
+    BLOCK_NONE     = 0,
+    BLOCK_BC1      = 1, // RGB, 4 bpp (DXT1, opaque)
+    BLOCK_BC3      = 2, // RGBA, 8 bpp (DXT5)
+    BLOCK_BC7      = 3, // RGBA, 8 bpp (mode 6 only)
+    BLOCK_ETC2_RGB = 4, // RGB, 4 bpp (ETC1-compatible individual/differential modes)
+};
+
+enum CompressedTextureFlags : uint32_t {
+    COMPRESSED_TEXTURE_FLIPPED_VERTICALLY = 1 << 0,
+};
+
+struct CompressedTextureHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format;
+    uint32_t w, h;
+    uint32_t levels;
+    uint32_t flags;
+    uint32_t reserved;
+};
+
+struct CompressedTextureLevel {
+    uint64_t offset;
+    uint64_t size;
+};
+
+int BlockFormatBytes(BlockFormat format) {
+    return (format == BLOCK_BC1 || format == BLOCK_ETC2_RGB) ? 8 : 16;
+}
+
+int BlockFormatChannels(BlockFormat format) {
+    return (format == BLOCK_BC1 || format == BLOCK_ETC2_RGB) ? 3 : 4;
+}
+
+size_t CompressedLevelSize(BlockFormat format, int w, int h) {
+    return (size_t)((w + 3)/4)*((h + 3)/4)*BlockFormatBytes(format);
+}
+
+size_t CompressedLevelOffset(BlockFormat format, int w, int h, int level) {
+    size_t offset = 0;
+    for (int i = 0; i < level; ++i) {
+        int lw = (w >> i) > 0 ? (w >> i) : 1, lh = (h >> i) > 0 ? (h >> i) : 1;
+        offset += CompressedLevelSize(format, lw, lh);
+    }
+    return offset;
+}
+
+//
+// Shared helpers
+//
+
+int ClampByte(int v) {
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// Copies the 4x4 block at (bx, by) of an RGBA8 image, clamping at the edges.
+void FetchBlock(const unsigned char* rgba, int w, int h, int bx, int by, unsigned char block[16][4]) {
+    for (int y = 0; y < 4; ++y) {
+        int sy = by*4 + y < h ? by*4 + y : h - 1;
+        for (int x = 0; x < 4; ++x) {
+            int sx = bx*4 + x < w ? bx*4 + x : w - 1;
+            memcpy(block[y*4 + x], rgba + ((size_t)sy*w + sx)*4, 4);
+        }
+    }
+}
+
+// Endpoints at the extremes of the block's principal axis (channels [0, n)).
+void PrincipalAxisEndpoints(const unsigned char block[16][4], int n, float lo[4], float hi[4]) {
+    float mean[4] = {};
+    for (int i = 0; i < 16; ++i) {
+        for (int c = 0; c < n; ++c) {
+            mean[c] += block[i][c]/16.0f;
+        }
+    }
+
+    float cov[4][4] = {};
+    for (int i = 0; i < 16; ++i) {
+        float d[4] = {};
+        for (int c = 0; c < n; ++c) {
+            d[c] = block[i][c] - mean[c];
+        }
+        for (int a = 0; a < n; ++a) {
+            for (int b = 0; b < n; ++b) {
+                cov[a][b] += d[a]*d[b];
+            }
+        }
+    }
+
+    // Power iteration, seeded with the bounding box diagonal.
+    float axis[4] = {};
+    for (int c = 0; c < n; ++c) {
+        unsigned char mn = 255, mx = 0;
+        for (int i = 0; i < 16; ++i) {
+            mn = block[i][c] < mn ? block[i][c] : mn;
+            mx = block[i][c] > mx ? block[i][c] : mx;
+        }
+        axis[c] = (float)(mx - mn) + 1e-3f;
+    }
+    for (int iteration = 0; iteration < 8; ++iteration) {
+        float next[4] = {};
+        float length = 0.0f;
+        for (int a = 0; a < n; ++a) {
+            for (int b = 0; b < n; ++b) {
+                next[a] += cov[a][b]*axis[b];
+            }
+            length = next[a]*next[a] > length ? next[a]*next[a] : length;
+        }
+        if (length < 1e-12f) {
+            break;
+        }
+        for (int c = 0; c < n; ++c) {
+            axis[c] = next[c];
+        }
+        float norm = 0.0f;
+        for (int c = 0; c < n; ++c) {
+            norm += axis[c]*axis[c];
+        }
+        norm = 1.0f/__builtin_sqrtf(norm);
+        for (int c = 0; c < n; ++c) {
+            axis[c] *= norm;
+        }
+    }
+    float norm = 0.0f;
+    for (int c = 0; c < n; ++c) {
+        norm += axis[c]*axis[c];
+    }
+    norm = norm > 0.0f ? 1.0f/__builtin_sqrtf(norm) : 0.0f;
+
+    float tMin = 1e30f, tMax = -1e30f;
+    for (int i = 0; i < 16; ++i) {
+        float t = 0.0f;
+        for (int c = 0; c < n; ++c) {
+            t += (block[i][c] - mean[c])*axis[c]*norm;
+        }
+        tMin = t < tMin ? t : tMin;
+        tMax = t > tMax ? t : tMax;
+    }
+    for (int c = 0; c < n; ++c) {
+        lo[c] = mean[c] + tMin*axis[c]*norm;
+        hi[c] = mean[c] + tMax*axis[c]*norm;
+    }
+}
+
+int ColorDistance(const unsigned char* a, const int* b, int n) {
+    int d = 0;
+    for (int c = 0; c < n; ++c) {
+        d += (a[c] - b[c])*(a[c] - b[c]);
+    }
+    return d;
+}
+
+//
+// BC1 / BC3
+//
+
+uint16_t PackRgb565(const float c[3]) {
+    int r = ClampByte((int)(c[0] + 0.5f)), g = ClampByte((int)(c[1] + 0.5f)), b = ClampByte((int)(c[2] + 0.5f));
+    return (uint16_t)(((r*31 + 127)/255) << 11 | ((g*63 + 127)/255) << 5 | ((b*31 + 127)/255));
+}
+
+void UnpackRgb565(uint16_t c, int out[3]) {
+    int r = c >> 11, g = (c >> 5) & 63, b = c & 31;
+    out[0] = (r << 3) | (r >> 2);
+    out[1] = (g << 2) | (g >> 4);
+    out[2] = (b << 3) | (b >> 2);
+}
+
+// Four-color BC1 block: PCA endpoints, one least-squares refinement pass.
+void EncodeBc1Block(const unsigned char block[16][4], unsigned char out[8]) {
+    float lo[4], hi[4];
+    PrincipalAxisEndpoints(block, 3, lo, hi);
+
+    uint16_t c0 = PackRgb565(hi), c1 = PackRgb565(lo);
+    uint32_t indices = 0;
+
+    for (int pass = 0; pass < 2; ++pass) {
+        if (c0 < c1) {
+            uint16_t t = c0; c0 = c1; c1 = t;
+        }
+
+        int palette[4][3];
+        UnpackRgb565(c0, palette[0]);
+        UnpackRgb565(c1, palette[1]);
+        for (int c = 0; c < 3; ++c) {
+            palette[2][c] = (2*palette[0][c] + palette[1][c] + 1)/3;
+            palette[3][c] = (palette[0][c] + 2*palette[1][c] + 1)/3;
+        }
+
+        indices = 0;
+        int chosen[16];
+        for (int i = 0; i < 16; ++i) {
+            int best = 0, bestDistance = 1 << 30;
+            for (int p = 0; p < (c0 == c1 ? 1 : 4); ++p) {
+                int d = ColorDistance(block[i], palette[p], 3);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    best = p;
+                }
+            }
+            chosen[i] = best;
+            indices |= (uint32_t)best << (2*i);
+        }
+
+        if (pass == 1 || c0 == c1) {
+            break;
+        }
+
+        // Solve for the endpoints that best reproduce the chosen indices.
+        static const float weight[4] = {1.0f, 0.0f, 2.0f/3.0f, 1.0f/3.0f};
+        float aa = 0, bb = 0, ab = 0, ax[3] = {}, bx[3] = {};
+        for (int i = 0; i < 16; ++i) {
+            float a = weight[chosen[i]], b = 1.0f - a;
+            aa += a*a; bb += b*b; ab += a*b;
+            for (int c = 0; c < 3; ++c) {
+                ax[c] += a*block[i][c];
+                bx[c] += b*block[i][c];
+            }
+        }
+        float det = aa*bb - ab*ab;
+        if (det < 1e-6f) {
+            break;
+        }
+        float e0[3], e1[3];
+        for (int c = 0; c < 3; ++c) {
+            e0[c] = (ax[c]*bb - bx[c]*ab)/det;
+            e1[c] = (bx[c]*aa - ax[c]*ab)/det;
+        }
+        uint16_t n0 = PackRgb565(e0), n1 = PackRgb565(e1);
+        if (n0 == n1) {
+            break;
+        }
+        c0 = n0;
+        c1 = n1;
+    }
+
+    out[0] = c0 & 0xff; out[1] = c0 >> 8;
+    out[2] = c1 & 0xff; out[3] = c1 >> 8;
+    memcpy(out + 4, &indices, 4);
+}
+
+// BC4-style 8-value alpha block, used as the first half of BC3.
+void EncodeAlphaBlock(const unsigned char block[16][4], unsigned char out[8]) {
+    int a0 = 0, a1 = 255;
+    for (int i = 0; i < 16; ++i) {
+        a0 = block[i][3] > a0 ? block[i][3] : a0;
+        a1 = block[i][3] < a1 ? block[i][3] : a1;
+    }
+
+    int palette[8] = {a0, a1};
+    for (int i = 1; i < 7; ++i) {
+        palette[i + 1] = ((7 - i)*a0 + i*a1 + 3)/7;
+    }
+
+    uint64_t indices = 0;
+    for (int i = 0; a0 != a1 && i < 16; ++i) {
+        int best = 0, bestDistance = 1 << 30;
+        for (int p = 0; p < 8; ++p) {
+            int d = (block[i][3] - palette[p])*(block[i][3] - palette[p]);
+            if (d < bestDistance) {
+                bestDistance = d;
+                best = p;
+            }
+        }
+        indices |= (uint64_t)best << (3*i);
+    }
+
+    out[0] = (unsigned char)a0;
+    out[1] = (unsigned char)a1;
+    for (int i = 0; i < 6; ++i) {
+        out[2 + i] = (unsigned char)(indices >> (8*i));
+    }
+}
+
+void EncodeBc3Block(const unsigned char block[16][4], unsigned char out[16]) {
+    EncodeAlphaBlock(block, out);
+    EncodeBc1Block(block, out + 8);
+}
+
+//
+// BC7 (mode 6: one subset, RGBA 7.7.7.7 endpoints + unique p-bit, 4-bit indices)
+//
+
+struct BitWriter {
+    unsigned char* out;
+    int bit;
+    void Write(uint32_t value, int count) {
+        for (int i = 0; i < count; ++i, ++bit) {
+            out[bit >> 3] |= ((value >> i) & 1) << (bit & 7);
+        }
+    }
+};
+
+// Picks the p-bit that best represents an 8-bit endpoint as 7 bits + p.
+void QuantizeBc7Endpoint(const float e[4], int q[4], int& p) {
+    int bestError = 1 << 30;
+    for (int pbit = 0; pbit < 2; ++pbit) {
+        int candidate[4], error = 0;
+        for (int c = 0; c < 4; ++c) {
+            int v = (int)((e[c] - pbit)/2.0f + 0.5f);
+            candidate[c] = v < 0 ? 0 : (v > 127 ? 127 : v);
+            int value = candidate[c]*2 + pbit;
+            error += (int)((value - e[c])*(value - e[c]));
+        }
+        if (error < bestError) {
+            bestError = error;
+            p = pbit;
+            memcpy(q, candidate, sizeof(candidate));
+        }
+    }
+}
+
+void EncodeBc7Block(const unsigned char block[16][4], unsigned char out[16]) {
+    static const int weights[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+    float lo[4], hi[4];
+    PrincipalAxisEndpoints(block, 4, lo, hi);
+
+    int q[2][4], p[2];
+    QuantizeBc7Endpoint(lo, q[0], p[0]);
+    QuantizeBc7Endpoint(hi, q[1], p[1]);
+
+    int palette[16][4];
+    for (int c = 0; c < 4; ++c) {
+        int e0 = q[0][c]*2 + p[0], e1 = q[1][c]*2 + p[1];
+        for (int i = 0; i < 16; ++i) {
+            palette[i][c] = ((64 - weights[i])*e0 + weights[i]*e1 + 32) >> 6;
+        }
+    }
+
+    int indices[16];
+    for (int i = 0; i < 16; ++i) {
+        int best = 0, bestDistance = 1 << 30;
+        for (int k = 0; k < 16; ++k) {
+            int d = ColorDistance(block[i], palette[k], 4);
+            if (d < bestDistance) {
+                bestDistance = d;
+                best = k;
+            }
+        }
+        indices[i] = best;
+    }
+
+    // The anchor (first) index is stored with its top bit implied zero.
+    if (indices[0] >= 8) {
+        for (int c = 0; c < 4; ++c) {
+            int t = q[0][c]; q[0][c] = q[1][c]; q[1][c] = t;
+        }
+        int t = p[0]; p[0] = p[1]; p[1] = t;
+        for (int i = 0; i < 16; ++i) {
+            indices[i] = 15 - indices[i];
+        }
+    }
+
+    memset(out, 0, 16);
+    BitWriter writer = {out, 0};
+    writer.Write(1 << 6, 7);
+    for (int c = 0; c < 4; ++c) {
+        writer.Write(q[0][c], 7);
+        writer.Write(q[1][c], 7);
+    }
+    writer.Write(p[0], 1);
+    writer.Write(p[1], 1);
+    for (int i = 0; i < 16; ++i) {
+        writer.Write(indices[i], i == 0 ? 3 : 4);
+    }
+}
+
+//
+// ETC2 RGB (individual and differential modes, which ETC2 decodes like ETC1)
+//
+
+static const int etcModifiers[8][4] = {
+    {2, 8, -2, -8}, {5, 17, -5, -17}, {9, 29, -9, -29}, {13, 42, -13, -42},
+    {18, 60, -18, -60}, {24, 80, -24, -80}, {33, 106, -33, -106}, {47, 183, -47, -183},
+};
+
+// Best modifier table for one subblock around base; returns error, fills indices.
+int FitEtcSubblock(const unsigned char block[16][4], const int* pixels, const int base[3], int& table, int indices[8]) {
+    int bestError = 1 << 30;
+    for (int t = 0; t < 8; ++t) {
+        int error = 0, chosen[8];
+        for (int i = 0; i < 8; ++i) {
+            int best = 0, bestDistance = 1 << 30;
+            for (int m = 0; m < 4; ++m) {
+                int color[3];
+                for (int c = 0; c < 3; ++c) {
+                    color[c] = ClampByte(base[c] + etcModifiers[t][m]);
+                }
+                int d = ColorDistance(block[pixels[i]], color, 3);
+                if (d < bestDistance) {
+                    bestDistance = d;
+                    best = m;
+                }
+            }
+            chosen[i] = best;
+            error += bestDistance;
+        }
+        if (error < bestError) {
+            bestError = error;
+            table = t;
+            memcpy(indices, chosen, sizeof(chosen));
+        }
+    }
+    return bestError;
+}
+
+void EncodeEtc2RgbBlock(const unsigned char block[16][4], unsigned char out[8]) {
+    uint64_t bestBits = 0;
+    int bestError = 1 << 30;
+
+    for (int flip = 0; flip < 2; ++flip) {
+        // Subblock pixel lists (block is row-major: index y*4 + x).
+        int pixels[2][8];
+        for (int s = 0, n0 = 0, n1 = 0; s < 16; ++s) {
+            int x = s & 3, y = s >> 2;
+            bool second = flip ? y >= 2 : x >= 2;
+            if (second) {
+                pixels[1][n1++] = s;
+            } else {
+                pixels[0][n0++] = s;
+            }
+        }
+
+        float average[2][3] = {};
+        for (int sub = 0; sub < 2; ++sub) {
+            for (int i = 0; i < 8; ++i) {
+                for (int c = 0; c < 3; ++c) {
+                    average[sub][c] += block[pixels[sub][i]][c]/8.0f;
+                }
+            }
+        }
+
+        for (int differential = 0; differential < 2; ++differential) {
+            int base[2][3], code[2][3];
+            bool representable = true;
+            for (int sub = 0; sub < 2; ++sub) {
+                for (int c = 0; c < 3; ++c) {
+                    if (differential) {
+                        code[sub][c] = (int)(average[sub][c]*31.0f/255.0f + 0.5f);
+                        base[sub][c] = (code[sub][c] << 3) | (code[sub][c] >> 2);
+                    } else {
+                        code[sub][c] = (int)(average[sub][c]*15.0f/255.0f + 0.5f);
+                        base[sub][c] = (code[sub][c] << 4) | code[sub][c];
+                    }
+                }
+            }
+            for (int c = 0; differential && c < 3; ++c) {
+                int delta = code[1][c] - code[0][c];
+                representable = representable && delta >= -4 && delta <= 3;
+            }
+            if (!representable) {
+                continue;
+            }
+
+            int tables[2], indices[2][8];
+            int error = FitEtcSubblock(block, pixels[0], base[0], tables[0], indices[0]) +
+                        FitEtcSubblock(block, pixels[1], base[1], tables[1], indices[1]);
+            if (error >= bestError) {
+                continue;
+            }
+            bestError = error;
+
+            uint64_t bits = 0;
+            for (int c = 0; c < 3; ++c) {
+                int shift = 56 - 8*c;
+                if (differential) {
+                    bits |= (uint64_t)code[0][c] << (shift + 3);
+                    bits |= (uint64_t)((code[1][c] - code[0][c]) & 7) << shift;
+                } else {
+                    bits |= (uint64_t)code[0][c] << (shift + 4);
+                    bits |= (uint64_t)code[1][c] << shift;
+                }
+            }
+            bits |= (uint64_t)tables[0] << 37;
+            bits |= (uint64_t)tables[1] << 34;
+            bits |= (uint64_t)differential << 33;
+            bits |= (uint64_t)flip << 32;
+
+            // Pixel indices are column-major; modifier m maps to (msb, lsb) = (m >> 1, m & 1).
+            for (int sub = 0; sub < 2; ++sub) {
+                for (int i = 0; i < 8; ++i) {
+                    int s = pixels[sub][i];
+                    int bit = (s & 3)*4 + (s >> 2);
+                    int m = indices[sub][i];
+                    bits |= (uint64_t)(m >> 1) << (16 + bit);
+                    bits |= (uint64_t)(m & 1) << bit;
+                }
+            }
+            bestBits = bits;
+        }
+    }
+
+    for (int i = 0; i < 8; ++i) {
+        out[i] = (unsigned char)(bestBits >> (56 - 8*i));
+    }
+}
+
+void EncodeBlock(BlockFormat format, const unsigned char block[16][4], unsigned char* out) {
+    switch (format) {
+        case BLOCK_BC1: EncodeBc1Block(block, out); break;
+        case BLOCK_BC3: EncodeBc3Block(block, out); break;
+        case BLOCK_BC7: EncodeBc7Block(block, out); break;
+        case BLOCK_ETC2_RGB: EncodeEtc2RgbBlock(block, out); break;
+        default: break;
+    }
+}
+
+// Encodes block rows [firstRow, lastRow) of an RGBA8 image.
+void EncodeBlockRows(BlockFormat format, const unsigned char* rgba, int w, int h, int firstRow, int lastRow, unsigned char* out) {
+    int blocksX = (w + 3)/4;
+    int blockBytes = BlockFormatBytes(format);
+    for (int by = firstRow; by < lastRow; ++by) {
+        for (int bx = 0; bx < blocksX; ++bx) {
+            unsigned char block[16][4];
+            FetchBlock(rgba, w, h, bx, by, block);
+            EncodeBlock(format, block, out + ((size_t)by*blocksX + bx)*blockBytes);
+        }
+    }
+}
@@ -0,0 +1,11 @@
+#version 400 core
+
+layout(location = 0) out vec4 color;
+
+in vec2 vTexCoord;
+
+uniform sampler2D uAtlas;
+
+void main() {
+  color = texture(uAtlas, vTexCoord);
+}
@@ -0,0 +1,25 @@
+#version 400 core
+
+// Instanced flipbook sprites: the corner comes from gl_VertexID (a 4-vertex
+// strip), everything else from per-instance attributes, and the frame from
+// uTime, so nothing is uploaded per frame to animate them.
+layout(location = 0) in vec4 aRect;    // x, y, w, h in clip space, from the bottom-left corner
+layout(location = 1) in vec2 aTiming;  // start time in seconds, frames per second
+layout(location = 2) in ivec2 aFrames; // first frame, frame count
+
+out vec2 vTexCoord;
+
+// FLIPBOOK_MAX_FRAMES in main.cpp
+layout(std140) uniform FlipbookFrames {
+  vec4 uFrameRects[256]; // u0, v0, u1, v1 with v0 the top edge
+};
+uniform float uTime;
+
+void main() {
+  vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1);
+  gl_Position = vec4(aRect.xy + corner * aRect.zw, 0.0, 1.0);
+
+  int elapsed = int(max(uTime - aTiming.x, 0.0) * aTiming.y);
+  vec4 rect = uFrameRects[aFrames.x + elapsed % max(aFrames.y, 1)];
+  vTexCoord = vec2(mix(rect.x, rect.z, corner.x), mix(rect.w, rect.y, corner.y));
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+// 64-bit non-cryptographic hash (wyhash-style multiply/fold). Used for asset
+// names and for keying caches on file or pixel contents, so it has to chew
+// through multi-megabyte buffers quickly: 16 bytes per step on two lanes.
+uint64_t HashMix(uint64_t a, uint64_t b) {
+    __uint128_t r = (__uint128_t)a * b;
+    return (uint64_t)r ^ (uint64_t)(r >> 64);
+}
+
+uint64_t HashRead64(const unsigned char* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t HashBytes(const void* data, size_t size, uint64_t seed = 0) {
+    const uint64_t k0 = 0xa0761d6478bd642full;
+    const uint64_t k1 = 0xe7037ed1a0b428dbull;
+    const uint64_t k2 = 0x8ebc6af09c88c6e3ull;
+
+    const unsigned char* p = (const unsigned char*)data;
+    uint64_t a = seed ^ k0;
+    uint64_t b = seed ^ k1 ^ size;
+
+    size_t remaining = size;
+    while (remaining >= 16) {
+        a = HashMix(HashRead64(p) ^ k1, a ^ k2);
+        b = HashMix(HashRead64(p + 8) ^ k2, b ^ k1);
+        p += 16;
+        remaining -= 16;
+    }
+
+    unsigned char tail[16] = {};
+    memcpy(tail, p, remaining);
+    a ^= HashRead64(tail);
+    b ^= HashRead64(tail + 8);
+
+    return HashMix(HashMix(a ^ k0, b ^ k2), size ^ k1);
+}
+
+uint64_t HashString(std::string_view s) {
+    return HashBytes(s.data(), s.size());
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+// Size-class pool for decoded image memory. stb_image (through STBI_MALLOC,
+// STBI_REALLOC and STBI_FREE), the pixel transform pass and mip chains all
+// allocate here, so a batch of loads keeps recycling the same few large
+// blocks instead of paying for mmap/munmap and fresh page faults per image.
+//
+// Requests of at least IMAGE_POOL_MIN_BLOCK bytes round up to one of four
+// classes per power of two (at most 25% slack); freed blocks wait on their
+// class's free list until IMAGE_POOL_MAX_CACHED bytes are parked, after
+// which they go straight back to the system. Smaller requests are plain
+// malloc. Every block carries a 16-byte header with its capacity, which
+// also lets ImageRealloc grow in place within the class.
+#define IMAGE_POOL_MIN_BLOCK  (64u << 10)
+#define IMAGE_POOL_MAX_CACHED ((size_t)256 << 20)
+#define IMAGE_POOL_CLASSES    (4*48) // 64 KiB to 2^63 bytes
+
+struct ImagePoolHeader {
+    size_t capacity; // usable bytes after the header
+    size_t pad;      // keeps the payload 16-byte aligned, like malloc's
+};
+
+struct ImagePool {
+    std::mutex mutex;
+    std::vector<ImagePoolHeader*> freeBlocks[IMAGE_POOL_CLASSES];
+    size_t cachedBytes = 0;
+    size_t hits = 0, misses = 0;
+};
+
+ImagePool imagePool;
+
+int FloorLog2(size_t x) {
+    return 63 - __builtin_clzll(x);
+}
+
+// Rounds size up to its class and returns the class index.
+int ImagePoolClass(size_t& size) {
+    size_t step = (size_t)1 << (FloorLog2(size) - 2);
+    size = (size + step - 1) & ~(step - 1);
+    int e = FloorLog2(size);
+    return (e - 16)*4 + (int)(size >> (e - 2)) - 4;
+}
+
+void* ImageAlloc(size_t size) {
+    size_t capacity = size;
+    ImagePoolHeader* block = nullptr;
+    if (size >= IMAGE_POOL_MIN_BLOCK) {
+        int sizeClass = ImagePoolClass(capacity);
+        std::lock_guard lock(imagePool.mutex);
+        auto& blocks = imagePool.freeBlocks[sizeClass];
+        if (!blocks.empty()) {
+            block = blocks.back();
+            blocks.pop_back();
+            imagePool.cachedBytes -= capacity;
+            ++imagePool.hits;
+        } else {
+            ++imagePool.misses;
+        }
+    }
+    if (!block) {
+        block = (ImagePoolHeader*)malloc(sizeof(ImagePoolHeader) + capacity);
+        if (!block) {
+            return nullptr;
+        }
+        block->capacity = capacity;
+    }
+    return block + 1;
+}
+
+void ImageFree(void* p) {
+    if (!p) {
+        return;
+    }
+    ImagePoolHeader* block = (ImagePoolHeader*)p - 1;
+    size_t capacity = block->capacity;
+    if (capacity >= IMAGE_POOL_MIN_BLOCK) {
+        int sizeClass = ImagePoolClass(capacity);
+        std::lock_guard lock(imagePool.mutex);
+        if (imagePool.cachedBytes + capacity <= IMAGE_POOL_MAX_CACHED) {
+            imagePool.freeBlocks[sizeClass].push_back(block);
+            imagePool.cachedBytes += capacity;
+            return;
+        }
+    }
+    free(block);
+}
+
+void* ImageRealloc(void* p, size_t size) {
+    if (!p) {
+        return ImageAlloc(size);
+    }
+    size_t capacity = ((ImagePoolHeader*)p - 1)->capacity;
+    if (size <= capacity) {
+        return p;
+    }
+    void* grown = ImageAlloc(size);
+    if (grown) {
+        memcpy(grown, p, capacity);
+        ImageFree(p);
+    }
+    return grown;
+}
+
+// Returns every parked block to the system, e.g. once a load batch is done.
+void TrimImagePool() {
+    std::lock_guard lock(imagePool.mutex);
+    for (auto& blocks : imagePool.freeBlocks) {
+        for (ImagePoolHeader* block : blocks) {
+            free(block);
+        }
+        blocks.clear();
+    }
+    imagePool.cachedBytes = 0;
+}
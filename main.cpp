@@ -1,6 +1,12 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include "imagePool.h"
+
+// Every decode allocation, and the pixels handed back, come from imagePool.
+#define STBI_MALLOC(size)     ImageAlloc(size)
+#define STBI_REALLOC(p, size) ImageRealloc(p, size)
+#define STBI_FREE(p)          ImageFree(p)
 #define STBI_FAILURE_USERMSG
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
@@ -9,12 +15,21 @@
 #include "imgui/backends/imgui_impl_glfw.h"
 #include "imgui/backends/imgui_impl_opengl3.h"
 
+#include <algorithm>
 #include <cassert>
+#include <chrono>
+#include <climits>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <deque>
 #include <initializer_list>
 #include <iostream>
+#include <random>
 #include <string>
 #include <string_view>
+#include <unordered_map>
+#include <vector>
 using namespace std;
 
 #include <errno.h>
@@ -22,13 +37,74 @@ using namespace std;
 #include <stdlib.h>
 #include <stdint.h>
 #include <sys/ptrace.h>
+#include <sys/stat.h>
+
+#include "assetPack.h"
+#include "blockCompress.h"
+#include "hash.h"
+#include "mappedFile.h"
+#include "mipmap.h"
+#include "pixelOps.h"
+#include "qoi.h"
+#include "threadPool.h"
+#include "tilePyramid.h"
+#include "tween.h"
+
+// How uncompressed samples are stored (see IMAGE_LOAD_HDR).
+enum PixelType {
+    PIXEL_TYPE_U8,       // 8-bit unorm per channel
+    PIXEL_TYPE_HALF,     // 16-bit float per channel
+    PIXEL_TYPE_RGB10_A2, // one 32-bit GL_UNSIGNED_INT_2_10_10_10_REV per pixel, channels == 4
+};
+
+int TexelBytes(PixelType type, int channels) {
+    return type == PIXEL_TYPE_HALF ? 2*channels : (type == PIXEL_TYPE_RGB10_A2 ? 4 : channels);
+}
 
 struct Image {
   int w, h;
   int channels;
-  unsigned char* data;
+  unsigned char* data; // from ImageAlloc unless borrowed
+  bool borrowed; // points into a mapping (e.g. the asset pack) or a caller's buffer, not owned
+  MappedFile* mapping; // set when data points into a mapping owned by this image (texture cache)
+  int levels; // mip levels stored back to back in data, see mipmap.h (0 or 1: base level only)
+  BlockFormat blockFormat; // data holds compressed blocks (.ctex), not pixels
+  bool srgb; // colour channels are sRGB-encoded, upload to an sRGB internal format
+  PixelType pixelType;
 };
 
+enum ImageLoadFlags {
+    IMAGE_LOAD_DEFAULT = 0,
+    IMAGE_LOAD_MIPS        = 1 << 0, // build the full CPU mip chain on the loading thread
+    IMAGE_LOAD_RGBA        = 1 << 1, // expand RGB to RGBA (opaque alpha) for 4-byte texels
+    IMAGE_LOAD_PREMULTIPLY = 1 << 2, // premultiply colour by alpha, for GL_ONE/GL_ONE_MINUS_SRC_ALPHA blending
+    IMAGE_LOAD_SRGB        = 1 << 3, // sample through GL_SRGB8(_ALPHA8) so filtering happens in linear space
+
+    // Decode JPEGs at reduced size with stb_image's scaled IDCTs, for images
+    // drawn much smaller than their native size. Other formats (and
+    // pre-decoded pack entries) still load at full size.
+    IMAGE_LOAD_JPEG_HALF    = 1 << 4,
+    IMAGE_LOAD_JPEG_QUARTER = 2 << 4,
+    IMAGE_LOAD_JPEG_EIGHTH  = 3 << 4,
+
+    // Drop channels the pixels do not use: opaque alpha goes (unless
+    // IMAGE_LOAD_RGBA asked for 4-byte texels), and gray RGB(A) becomes
+    // 1 or 2 channels, sampled through a swizzle (see SetGlTextureSwizzle).
+    // Gray sRGB RGB(A) images keep their colour channels, as core GL has no
+    // single-channel sRGB format.
+    IMAGE_LOAD_REDUCE_FORMAT = 1 << 6,
+
+    // Keep 16-bit PNGs and Radiance .hdr files at 16 bits per sample instead
+    // of 8: packed as RGB10_A2 when that loses nothing, otherwise as half
+    // floats. High-precision images skip the decoded-texture cache, format
+    // reduction, sRGB and the CPU mip chain (glGenerateMipmap fills it).
+    IMAGE_LOAD_HDR = 1 << 7,
+};
+
+int JpegScaleShift(int flags) {
+    return (flags >> 4) & 3;
+}
+
 struct GlVertexAttrib {
     unsigned int glType, count;
 };
@@ -49,231 +125,2637 @@ struct Vertex {
 };
 struct Quad { Vertex tl, tr, br, bl; };
 
+// Images are stored top row first (see SetFlipImagesOnLoad), so v runs
+// downwards: the top edge samples v = 0.
 Quad CreateQuad(float x, float y, float size, Color color, float texID) {
     Quad r = {};
-    r.tl = {x     , y     , 0.0, 1.0, color, texID};
-    r.tr = {x+size, y     , 1.0, 1.0, color, texID};
-    r.br = {x+size, y-size, 1.0, 0.0, color, texID};
-    r.bl = {x     , y-size, 0.0, 0.0, color, texID};
+    r.tl = {x     , y     , 0.0, 0.0, color, texID};
+    r.tr = {x+size, y     , 1.0, 0.0, color, texID};
+    r.br = {x+size, y-size, 1.0, 1.0, color, texID};
+    r.bl = {x     , y-size, 0.0, 1.0, color, texID};
     return r;
 }
 
-Image ReadImage(const char* path) {
+AssetPack assetPack;
+bool flipImagesOnLoad = false;
+
+// Flipping is folded into ApplyPixelTransforms' single pass rather than
+// stb_image's separate row-swapping pass. Geometry that flips its v
+// coordinate instead (CreateQuad) can leave it off and skip the work.
+void SetFlipImagesOnLoad(bool flip) {
+    flipImagesOnLoad = flip;
+}
+
+// Resolves a path against the asset pack first, then the filesystem.
+MappedFile ReadFile(const char* path, int mapFlags = MAP_FILE_POPULATE) {
+    if (auto entry = FindAsset(assetPack, path); entry && entry->kind == ASSET_RAW) {
+        auto bytes = AssetBytes(assetPack, *entry);
+        return MappedFile(bytes.data(), bytes.size());
+    }
+    return MapFile(path, mapFlags);
+}
+
+// Decoded-texture cache: GL-ready pixels stored raw under TEXTURE_CACHE_DIR,
+// keyed by a hash of the source file bytes and the load flags. A hit maps the
+// cache file and hands its pixels straight to glTexImage2D without decoding.
+#define TEXTURE_CACHE_DIR     ".texcache"
+#define TEXTURE_CACHE_MAGIC   0x43584554u // "TEXC"
+#define TEXTURE_CACHE_VERSION 1u
+
+bool textureCacheEnabled = true;
+
+struct TextureCacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t key;
+    uint32_t w, h;
+    uint32_t channels;
+    uint32_t levels;     // mip levels stored back to back, largest first
+    uint64_t dataOffset;
+    uint64_t dataSize;
+};
+
+uint64_t TextureCacheKey(span<const unsigned char> source, int flags) {
+    uint64_t loadFlags = (flipImagesOnLoad ? 1 : 0) | (flags << 1);
+    return HashBytes(source.data(), source.size(), (TEXTURE_CACHE_VERSION << 8) | loadFlags);
+}
+
+string TextureCachePath(uint64_t key) {
+    char path[64];
+    snprintf(path, sizeof(path), TEXTURE_CACHE_DIR "/%016llx.tex", (unsigned long long)key);
+    return path;
+}
+
+bool ReadTextureCache(uint64_t key, Image& img) {
+    MappedFile file = MapFile(TextureCachePath(key).c_str(), MAP_FILE_POPULATE | MAP_FILE_OPTIONAL);
+    if (!file || file.size < sizeof(TextureCacheHeader)) {
+        return false;
+    }
+
+    auto header = (const TextureCacheHeader*)file.data;
+    if (header->magic != TEXTURE_CACHE_MAGIC || header->version != TEXTURE_CACHE_VERSION || header->key != key ||
+        header->levels < 1 || header->dataOffset + header->dataSize > file.size ||
+        header->dataSize < MipChainSize(header->w, header->h, header->channels, header->levels)) {
+        return false;
+    }
+
+    img.w = header->w;
+    img.h = header->h;
+    img.channels = header->channels;
+    img.data = (unsigned char*)file.data + header->dataOffset;
+    img.borrowed = true;
+    img.mapping = new MappedFile(std::move(file));
+    img.levels = header->levels;
+    return true;
+}
+
+// Written to a temporary name and renamed into place so concurrent loaders
+// never map a half-written entry. Failures only cost the cache, not the load.
+void WriteTextureCache(uint64_t key, Image const& img) {
+    if (mkdir(TEXTURE_CACHE_DIR, 0755) == -1 && errno != EEXIST) {
+        perror("mkdir " TEXTURE_CACHE_DIR);
+        return;
+    }
+
+    TextureCacheHeader header = {};
+    header.magic = TEXTURE_CACHE_MAGIC;
+    header.version = TEXTURE_CACHE_VERSION;
+    header.key = key;
+    header.w = img.w;
+    header.h = img.h;
+    header.channels = img.channels;
+    header.levels = img.levels > 1 ? img.levels : 1;
+    header.dataOffset = 64;
+    header.dataSize = MipChainSize(img.w, img.h, img.channels, header.levels);
+    static_assert(sizeof(TextureCacheHeader) <= 64);
+
+    string path = TextureCachePath(key);
+    string tmpPath = path + ".XXXXXX";
+    int fd = mkstemp(tmpPath.data());
+    FILE* file = fd == -1 ? nullptr : fdopen(fd, "wb");
+    if (file == nullptr) {
+        perror("WriteTextureCache");
+        if (fd != -1) {
+            close(fd);
+            unlink(tmpPath.c_str());
+        }
+        return;
+    }
+
+    unsigned char headerBytes[64] = {};
+    memcpy(headerBytes, &header, sizeof(header));
+    bool ok = fwrite(headerBytes, 1, sizeof(headerBytes), file) == sizeof(headerBytes) &&
+              fwrite(img.data, 1, header.dataSize, file) == header.dataSize;
+    ok = (fclose(file) != EOF) && ok;
+
+    if (!ok || rename(tmpPath.c_str(), path.c_str()) == -1) {
+        perror("WriteTextureCache");
+        unlink(tmpPath.c_str());
+    }
+}
+
+// Gives up img's pixels, whichever way it holds them.
+void ReleaseImageData(Image& img) {
+    if (img.borrowed) {
+        delete img.mapping;
+        img.mapping = nullptr;
+        img.borrowed = false;
+    } else {
+        ImageFree(img.data);
+    }
+    img.data = nullptr;
+}
+
+// Applies the requested flip/expand/premultiply in one sweep (pixelOps.h).
+// Works in place when it can, otherwise writes a fresh buffer (or dst, when
+// the caller supplies the destination; see ReadImage) and releases the
+// source, copying out of borrowed memory as AddMipChain does.
+void ApplyPixelTransforms(Image& img, int flags, bool flip, unsigned char* dst = nullptr, size_t dstSize = 0) {
+    int transform = (flip ? PIXEL_FLIP_ROWS : 0) |
+                    ((flags & IMAGE_LOAD_RGBA) && img.channels == 3 ? PIXEL_EXPAND_RGBA : 0) |
+                    ((flags & IMAGE_LOAD_PREMULTIPLY) && img.channels == 4 ? PIXEL_PREMULTIPLY : 0);
+    img.srgb = flags & IMAGE_LOAD_SRGB;
+    if (transform == 0 && (!dst || img.data == dst)) {
+        return;
+    }
+
+    int channels = TransformedChannels(img.channels, transform);
+    bool reshapes = transform & (PIXEL_FLIP_ROWS | PIXEL_EXPAND_RGBA);
+    size_t size = (size_t)img.w*img.h*channels;
+    unsigned char* out = dst;
+    if (dst && size > dstSize) {
+        cerr << "ApplyPixelTransforms: " << img.w << "x" << img.h << "x" << channels << " image does not fit in " << dstSize << " bytes\n";
+        exit(1);
+    }
+    if (!dst) {
+        out = !img.borrowed && !reshapes ? img.data : (unsigned char*)ImageAlloc(size);
+    }
+    if (!out) {
+        cerr << "ApplyPixelTransforms: out of memory\n";
+        exit(1);
+    }
+    assert(out != img.data || !reshapes);
+
+    TransformPixels(img.data, img.w, img.h, img.channels, out, transform);
+
+    if (out != img.data) {
+        ReleaseImageData(img);
+        img.data = out;
+        img.borrowed = out == dst;
+    }
+    img.channels = channels;
+}
+
+// Grows img.data to hold the full chain (copying out of borrowed memory) and
+// fills in every level below the base. A chain already sitting in the
+// caller's dst is extended in place, if dstSize allows.
+void AddMipChain(Image& img, unsigned char* dst = nullptr, size_t dstSize = 0) {
+    int levels = MipLevelCount(img.w, img.h);
+    if (img.levels == levels) {
+        return;
+    }
+
+    size_t chainSize = MipChainSize(img.w, img.h, img.channels, levels);
+    if (dst && img.data == dst) {
+        if (chainSize > dstSize) {
+            cerr << "AddMipChain: " << chainSize << " byte mip chain does not fit in " << dstSize << " bytes\n";
+            exit(1);
+        }
+    } else if (img.borrowed) {
+        unsigned char* chain = (unsigned char*)ImageAlloc(chainSize);
+        if (chain) {
+            memcpy(chain, img.data, MipLevelSize(img.w, img.h, img.channels, 0));
+        }
+        ReleaseImageData(img);
+        img.data = chain;
+    } else {
+        // Stays put when the block's size class has room for the chain.
+        img.data = (unsigned char*)ImageRealloc(img.data, chainSize);
+    }
+    if (!img.data) {
+        cerr << "AddMipChain: out of memory\n";
+        exit(1);
+    }
+
+    GenerateMipChain(img.data, img.w, img.h, img.channels, levels);
+    img.levels = levels;
+}
+
+// Block-compressed .ctex files are passed through as-is: the blocks stay in
+// the mapping and LoadGlTexture uploads them with glCompressedTexImage2D.
+bool ReadCompressedTexture(const char* path, MappedFile& file, Image& img) {
+    if (file.size < sizeof(CompressedTextureHeader) || ((const CompressedTextureHeader*)file.data)->magic != COMPRESSED_TEXTURE_MAGIC) {
+        return false;
+    }
+
+    auto header = (const CompressedTextureHeader*)file.data;
+    auto levelTable = (const CompressedTextureLevel*)(file.data + sizeof(CompressedTextureHeader));
+    BlockFormat format = (BlockFormat)header->format;
+    bool valid = header->version == COMPRESSED_TEXTURE_VERSION && format >= BLOCK_BC1 && format <= BLOCK_ETC2_RGB &&
+                 header->levels >= 1 && sizeof(CompressedTextureHeader) + header->levels*sizeof(CompressedTextureLevel) <= file.size;
+    for (uint32_t level = 0; valid && level < header->levels; ++level) {
+        valid = levelTable[level].offset == levelTable[0].offset + CompressedLevelOffset(format, header->w, header->h, level) &&
+                levelTable[level].offset + levelTable[level].size <= file.size;
+    }
+    if (!valid) {
+        cerr << "ReadImage: " << path << " is not a valid version " << COMPRESSED_TEXTURE_VERSION << " .ctex file\n";
+        exit(1);
+    }
+
+    bool flipped = header->flags & COMPRESSED_TEXTURE_FLIPPED_VERTICALLY;
+    if (flipped != flipImagesOnLoad) {
+        cerr << "ReadImage: " << path << " was converted " << (flipped ? "with" : "without") << " a vertical flip (texconv -v)\n";
+    }
+
+    img.w = header->w;
+    img.h = header->h;
+    img.channels = BlockFormatChannels(format);
+    img.levels = header->levels;
+    img.blockFormat = format;
+    img.data = (unsigned char*)file.data + levelTable[0].offset;
+    img.borrowed = true;
+    img.mapping = new MappedFile(std::move(file));
+    return true;
+}
+
+// See IMAGE_LOAD_REDUCE_FORMAT. Works in place on owned pixels (and the
+// caller's dst); pixels borrowed from a mapping are copied out.
+void ReduceImageFormat(Image& img, int flags, unsigned char* dst) {
+    if (!(flags & IMAGE_LOAD_REDUCE_FORMAT) || img.blockFormat || img.channels == 1) {
+        return;
+    }
+
+    int content = AnalyzePixels(img.data, (size_t)img.w*img.h, img.channels);
+    int channels = ReducedChannelCount(img.channels, content, img.srgb, flags & IMAGE_LOAD_RGBA);
+    assert(channels <= img.channels);
+    if (channels == img.channels) {
+        return;
+    }
+
+    size_t count = (size_t)img.w*img.h;
+    bool inPlace = img.data == dst || !img.borrowed;
+    unsigned char* out = inPlace ? img.data : (unsigned char*)ImageAlloc(count*channels);
+    if (!out) {
+        cerr << "ReduceImageFormat: out of memory\n";
+        exit(1);
+    }
+    ReducePixels(img.data, count, img.channels, out, channels);
+    if (!inPlace) {
+        ReleaseImageData(img);
+        img.data = out;
+    }
+    img.channels = channels;
+}
+
+// Steps every decoding path ends with. Reducing first makes the mip chain
+// cheaper too.
+void FinishDecodedImage(Image& img, int flags, unsigned char* dst, size_t dstSize) {
+    ReduceImageFormat(img, flags, dst);
+    if (flags & IMAGE_LOAD_MIPS) {
+        AddMipChain(img, dst, dstSize);
+    }
+}
+
+// Copies whatever img holds into dst and releases it, for the load paths
+// that cannot produce their result in the caller's buffer directly.
+void MoveImageInto(Image& img, unsigned char* dst, size_t dstSize) {
+    int levels = img.levels > 1 ? img.levels : 1;
+    size_t size = img.blockFormat ? CompressedLevelOffset(img.blockFormat, img.w, img.h, levels)
+                                  : MipChainSize(img.w, img.h, TexelBytes(img.pixelType, img.channels), levels);
+    if (size > dstSize) {
+        cerr << "ReadImage: " << size << " byte image does not fit in " << dstSize << " bytes\n";
+        exit(1);
+    }
+    memcpy(dst, img.data, size);
+    ReleaseImageData(img);
+    img.data = dst;
+    img.borrowed = true;
+}
+
+// PNG rows are unfiltered against the row above, read back from the output.
+bool IsPng(MappedFile const& file) {
+    return file.size >= 8 && memcmp(file.data, "\x89PNG\r\n\x1a\n", 8) == 0;
+}
+
+bool IsHighPrecisionImage(MappedFile const& file) {
+    return stbi_is_hdr_from_memory(file.data, (int)file.size) || stbi_is_16_bit_from_memory(file.data, (int)file.size);
+}
+
+// See IMAGE_LOAD_HDR. Premultiplication happens at full precision and the
+// flip rides along with packing or expansion, as in ApplyPixelTransforms.
+void ReadHighPrecisionImage(MappedFile const& file, int flags, Image& img) {
+    bool premultiply = flags & IMAGE_LOAD_PREMULTIPLY;
+    uint16_t* samples;
+    size_t count;
+    if (stbi_is_hdr_from_memory(file.data, (int)file.size)) {
+        float* floats = stbi_loadf_from_memory(file.data, (int)file.size, &img.w, &img.h, &img.channels, 0);
+        if (!floats) {
+            printf("ReadImage failed: %s\n", stbi_failure_reason());
+            exit(1);
+        }
+        count = (size_t)img.w*img.h;
+        if (premultiply && img.channels == 4) {
+            PremultiplyFloats(floats, count);
+        }
+        // Each half lands at or before the float it came from, so they share the buffer.
+        samples = (uint16_t*)floats;
+        FloatsToHalves(floats, samples, count*img.channels);
+        samples = (uint16_t*)ImageRealloc(samples, count*img.channels*sizeof(uint16_t));
+    } else {
+        samples = stbi_load_16_from_memory(file.data, (int)file.size, &img.w, &img.h, &img.channels, 0);
+        if (!samples) {
+            printf("ReadImage failed: %s\n", stbi_failure_reason());
+            exit(1);
+        }
+        count = (size_t)img.w*img.h;
+        if (premultiply && img.channels == 4) {
+            PremultiplyUnorm16(samples, count);
+        }
+        if ((img.channels == 3 || img.channels == 4) && FitsRgb10A2(samples, count, img.channels)) {
+            uint32_t* packed = flipImagesOnLoad ? (uint32_t*)ImageAlloc(count*sizeof(uint32_t)) : (uint32_t*)samples;
+            if (!packed) {
+                cerr << "ReadImage: out of memory\n";
+                exit(1);
+            }
+            PackRgb10A2(samples, img.w, img.h, img.channels, packed, flipImagesOnLoad);
+            if (packed != (uint32_t*)samples) {
+                ImageFree(samples);
+            }
+            img.data = (unsigned char*)packed;
+            img.channels = 4;
+            img.pixelType = PIXEL_TYPE_RGB10_A2;
+            return;
+        }
+        Unorm16ToHalves(samples, samples, count*img.channels);
+    }
+    img.pixelType = PIXEL_TYPE_HALF;
+
+    int transform = (flipImagesOnLoad ? PIXEL_FLIP_ROWS : 0) | ((flags & IMAGE_LOAD_RGBA) && img.channels == 3 ? PIXEL_EXPAND_RGBA : 0);
+    if (transform) {
+        int channels = TransformedChannels(img.channels, transform);
+        uint16_t* out = (uint16_t*)ImageAlloc(count*channels*sizeof(uint16_t));
+        if (!out) {
+            cerr << "ReadImage: out of memory\n";
+            exit(1);
+        }
+        TransformPixels16(samples, img.w, img.h, img.channels, out, transform, 0x3c00 /* 1.0 */);
+        ImageFree(samples);
+        samples = out;
+        img.channels = channels;
+    }
+    img.data = (unsigned char*)samples;
+}
+
+// With dst, the pixels (and mip chain) land in the caller's dstSize bytes,
+// e.g. a mapped pixel unpack buffer, and img.data == dst is borrowed. dst is
+// only ever written: it is usually mapped write-only and invalidated. So
+// stb_image (PNG aside, and with the texture cache off) and QOI decode into
+// it, and packed images are transformed into it, only when nothing reads the
+// pixels back afterwards; otherwise the image is finished on the heap and
+// copied in.
+Image ReadImage(const char* path, int flags = IMAGE_LOAD_DEFAULT, unsigned char* dst = nullptr, size_t dstSize = 0) {
+    if (dst && (flags & (IMAGE_LOAD_PREMULTIPLY | IMAGE_LOAD_REDUCE_FORMAT | IMAGE_LOAD_MIPS))) {
+        Image img = ReadImage(path, flags);
+        MoveImageInto(img, dst, dstSize);
+        return img;
+    }
+
     Image img = {};
-    img.data = stbi_load(path, &img.w, &img.h, &img.channels, 0);
+    bool decodeIntoDst = dst && !flipImagesOnLoad && !(flags & IMAGE_LOAD_RGBA);
+
+    // Packed images are used even when packed with the other flip setting:
+    // the flip rides along in the transform pass.
+    auto entry = FindAsset(assetPack, path);
+    if (entry && entry->kind == ASSET_IMAGE) {
+        bool entryFlipped = entry->flags & ASSET_FLIPPED_VERTICALLY;
+        img.w = entry->w;
+        img.h = entry->h;
+        img.channels = entry->channels;
+        img.data = (unsigned char*)AssetBytes(assetPack, *entry).data();
+        img.borrowed = true;
+        ApplyPixelTransforms(img, flags, entryFlipped != flipImagesOnLoad, dst, dstSize);
+        FinishDecodedImage(img, flags, dst, dstSize);
+        return img;
+    }
+
+    MappedFile file = ReadFile(path);
+    if (ReadCompressedTexture(path, file, img)) {
+        if (dst) {
+            MoveImageInto(img, dst, dstSize);
+        }
+        return img;
+    }
+
+    // QOI decodes faster than the cache could be mapped and checked, so it skips the cache.
+    if (IsQoi(file.data, file.size)) {
+        if (!QoiInfo(file.data, file.size, &img.w, &img.h, &img.channels)) {
+            printf("ReadImage failed: %s is not a valid QOI file\n", path);
+            exit(1);
+        }
+        size_t size = (size_t)img.w*img.h*img.channels;
+        bool intoDst = decodeIntoDst && size <= dstSize;
+        img.data = intoDst ? dst : (unsigned char*)ImageAlloc(size);
+        img.borrowed = intoDst;
+        if (!img.data) {
+            cerr << "ReadImage: out of memory\n";
+            exit(1);
+        }
+        QoiDecodeInto(file.data, file.size, img.data);
+        ApplyPixelTransforms(img, flags, flipImagesOnLoad, dst, dstSize);
+        FinishDecodedImage(img, flags, dst, dstSize);
+        return img;
+    }
+
+    if ((flags & IMAGE_LOAD_HDR) && IsHighPrecisionImage(file)) {
+        ReadHighPrecisionImage(file, flags, img);
+        if (dst) {
+            MoveImageInto(img, dst, dstSize);
+        }
+        return img;
+    }
+
+    uint64_t cacheKey = 0;
+    if (textureCacheEnabled) {
+        cacheKey = TextureCacheKey(file.Bytes(), flags);
+        if (ReadTextureCache(cacheKey, img)) {
+            img.srgb = flags & IMAGE_LOAD_SRGB;
+            if (dst) {
+                MoveImageInto(img, dst, dstSize);
+            }
+            return img;
+        }
+    }
+
+    // The cache write reads the pixels back.
+    decodeIntoDst = decodeIntoDst && !textureCacheEnabled && !IsPng(file);
+
+    // Per thread, since ReadImage runs on pool workers with different flags.
+    stbi_set_jpeg_scale_on_load_thread(JpegScaleShift(flags));
+    if (decodeIntoDst) {
+        img.data = stbi_load_from_memory_into(file.data, (int)file.size, &img.w, &img.h, &img.channels, 0, dst, dstSize);
+        img.borrowed = true;
+    } else {
+        img.data = stbi_load_from_memory(file.data, (int)file.size, &img.w, &img.h, &img.channels, 0);
+    }
+    stbi_set_jpeg_scale_on_load_thread(0);
     if (!img.data) {
       printf("ReadImage failed: %s\n", stbi_failure_reason());
       exit(1);
     }
-    return img;
+
+    unsigned char* finishDst = decodeIntoDst ? dst : nullptr;
+    ApplyPixelTransforms(img, flags, flipImagesOnLoad, finishDst, dstSize);
+    FinishDecodedImage(img, flags, finishDst, dstSize);
+
+    if (textureCacheEnabled) {
+        WriteTextureCache(cacheKey, img);
+    }
+    if (dst && img.data != dst) {
+        MoveImageInto(img, dst, dstSize);
+    }
+    return img;
+}
+
+// Decodes on a pool worker; the GL thread uploads once the future is ready.
+// Higher priorities are picked up first. path must outlive the job.
+future<Image> ReadImageAsync(ThreadPool& pool, const char* path, int flags = IMAGE_LOAD_DEFAULT, int priority = 0) {
+    return pool.Submit([path, flags] { return ReadImage(path, flags); }, priority);
+}
+
+// What ReadImage(path, flags) will return, minus the pixels.
+struct ImageInfo {
+    int w, h;
+    int channels; // an upper bound with IMAGE_LOAD_REDUCE_FORMAT, which needs the pixels
+    int levels; // IMAGE_LOAD_MIPS chain, or the levels a .ctex carries
+    BlockFormat blockFormat;
+    bool srgb;
+    PixelType pixelType; // HALF is an upper bound for IMAGE_LOAD_HDR, which may pack to RGB10_A2
+};
+
+// Reads only the header (pack index, .ctex/QOI header or stbi_info; files
+// are mapped without prefaulting), so texture storage and layout can be
+// settled before the decode is even scheduled. Returns false when the
+// header is not understood, with stbi_failure_reason set for stb formats.
+bool ProbeImage(const char* path, int flags, ImageInfo& info) {
+    info = {};
+    bool ok;
+    if (auto entry = FindAsset(assetPack, path); entry && entry->kind == ASSET_IMAGE) {
+        info.w = entry->w;
+        info.h = entry->h;
+        info.channels = entry->channels;
+        ok = true;
+    } else {
+        MappedFile file = ReadFile(path, MAP_FILE_DEFAULT);
+        if (file.size >= sizeof(CompressedTextureHeader) && ((const CompressedTextureHeader*)file.data)->magic == COMPRESSED_TEXTURE_MAGIC) {
+            auto header = (const CompressedTextureHeader*)file.data;
+            info.w = header->w;
+            info.h = header->h;
+            info.blockFormat = (BlockFormat)header->format;
+            info.channels = BlockFormatChannels(info.blockFormat);
+            info.levels = header->levels;
+            return header->version == COMPRESSED_TEXTURE_VERSION && header->levels >= 1;
+        }
+        if (IsQoi(file.data, file.size)) {
+            ok = QoiInfo(file.data, file.size, &info.w, &info.h, &info.channels);
+        } else {
+            ok = stbi_info_from_memory(file.data, (int)file.size, &info.w, &info.h, &info.channels);
+            if (ok && (flags & IMAGE_LOAD_HDR) && IsHighPrecisionImage(file)) {
+                info.pixelType = PIXEL_TYPE_HALF;
+            }
+            // stbi_info reports JPEGs at full size, whatever the scaled decode will give.
+            int shift = JpegScaleShift(flags);
+            if (ok && shift && file.size >= 2 && file.data[0] == 0xff && file.data[1] == 0xd8) {
+                info.w = (info.w + (1 << shift) - 1) >> shift;
+                info.h = (info.h + (1 << shift) - 1) >> shift;
+            }
+        }
+    }
+    if (ok && (flags & IMAGE_LOAD_RGBA) && info.channels == 3) {
+        info.channels = 4;
+    }
+    info.levels = (flags & IMAGE_LOAD_MIPS) && info.pixelType == PIXEL_TYPE_U8 ? MipLevelCount(info.w, info.h) : 1;
+    info.srgb = (flags & IMAGE_LOAD_SRGB) && info.pixelType == PIXEL_TYPE_U8;
+    return ok;
+}
+
+// Lets stb_image split one large JPEG across the pool (restart intervals and
+// colour conversion bands). Safe from inside ReadImageAsync jobs, since the
+// calling worker takes part in the loop.
+void StbParallelFor(void* pool, void (*task)(void* taskData, int index), void* taskData, int count) {
+    ((ThreadPool*)pool)->ParallelFor(count, [&](int i) { task(taskData, i); });
+}
+
+void FreeImage(Image const& img) {
+    delete img.mapping;
+    if (img.borrowed) {
+        return;
+    }
+    ImageFree(img.data);
+}
+
+// sRGB only applies to 3 and 4 channels; core GL has no single-channel sRGB format.
+void GetGlTextureFormat(int channels, GLenum& format, GLenum& internalFormat, bool srgb = false, PixelType type = PIXEL_TYPE_U8) {
+    if (type == PIXEL_TYPE_HALF) {
+        const GLenum formats[] = {GL_RED, GL_RG, GL_RGB, GL_RGBA}, internalFormats[] = {GL_R16F, GL_RG16F, GL_RGB16F, GL_RGBA16F};
+        assert(channels >= 1 && channels <= 4);
+        format = formats[channels - 1];
+        internalFormat = internalFormats[channels - 1];
+    } else if (type == PIXEL_TYPE_RGB10_A2) {
+        format = GL_RGBA;
+        internalFormat = GL_RGB10_A2;
+    } else if (channels == 1) {
+        format = GL_RED;
+        internalFormat = GL_R8;
+    } else if (channels == 2) {
+        format = GL_RG;
+        internalFormat = GL_RG8;
+    } else if (channels == 3) {
+        format = GL_RGB;
+        internalFormat = srgb ? GL_SRGB8 : GL_RGB8;
+    } else if (channels == 4) {
+        format = GL_RGBA;
+        internalFormat = srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8;
+    } else {
+        cerr << "Unsupported channel count: " << channels << endl;
+        exit(1);
+    }
+}
+
+GLenum GetGlPixelType(PixelType type) {
+    return type == PIXEL_TYPE_HALF ? GL_HALF_FLOAT : (type == PIXEL_TYPE_RGB10_A2 ? GL_UNSIGNED_INT_2_10_10_10_REV : GL_UNSIGNED_BYTE);
+}
+
+// 1- and 2-channel images are gray and gray+alpha (stb_image's layout), so
+// the shader sees them as RGB(A) through the swizzle instead of as red.
+void SetGlTextureSwizzle(int channels) {
+    GLint swizzle[4] = {GL_RED, GL_GREEN, GL_BLUE, GL_ALPHA};
+    if (channels == 1) {
+        swizzle[1] = swizzle[2] = GL_RED;
+        swizzle[3] = GL_ONE;
+    } else if (channels == 2) {
+        swizzle[1] = swizzle[2] = GL_RED;
+        swizzle[3] = GL_GREEN;
+    }
+    glTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+}
+
+enum MipmapMode {
+    MIPMAP_NONE, // single level, GL_LINEAR
+    MIPMAP_GPU,  // immutable full chain filled by glGenerateMipmap
+    MIPMAP_CPU,  // immutable full chain uploaded from img (see IMAGE_LOAD_MIPS), GPU fallback otherwise
+};
+
+// Allocates every level up front: immutable storage when available, otherwise
+// the equivalent mutable levels with GL_TEXTURE_MAX_LEVEL clamped.
+void AllocateGlTextureStorage(GLenum internalFormat, GLenum format, int w, int h, int levels) {
+    if (GLEW_ARB_texture_storage) {
+        glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, w, h);
+    } else {
+        for (int level = 0; level < levels; ++level) {
+            glTexImage2D(GL_TEXTURE_2D, level, internalFormat, MipDimension(w, level), MipDimension(h, level), 0, format, GL_UNSIGNED_BYTE, nullptr);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+    }
+}
+
+GLenum GetGlCompressedFormat(BlockFormat format) {
+    GLenum glFormat = 0;
+    bool supported = false;
+    switch (format) {
+        case BLOCK_BC1: glFormat = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; supported = GLEW_EXT_texture_compression_s3tc; break;
+        case BLOCK_BC3: glFormat = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; supported = GLEW_EXT_texture_compression_s3tc; break;
+        case BLOCK_BC7: glFormat = GL_COMPRESSED_RGBA_BPTC_UNORM; supported = GLEW_ARB_texture_compression_bptc; break;
+        case BLOCK_ETC2_RGB: glFormat = GL_COMPRESSED_RGB8_ETC2; supported = GLEW_ARB_ES3_compatibility; break;
+        default: break;
+    }
+    if (!supported) {
+        cerr << "Unsupported block format: " << format << endl;
+        exit(1);
+    }
+    return glFormat;
+}
+
+int GlTextureLevels(ImageInfo const& info, MipmapMode mipmaps) {
+    if (mipmaps == MIPMAP_NONE) {
+        return 1;
+    }
+    // Compressed images cannot be mipmapped by glGenerateMipmap, so they use
+    // whatever levels the .ctex file carries (texconv -m).
+    if (info.blockFormat) {
+        return info.levels > 1 ? info.levels : 1;
+    }
+    return MipLevelCount(info.w, info.h);
+}
+
+// Creates the texture and allocates all of its levels from ProbeImage's
+// description, bound to the active unit; UploadGlTexture fills it in once
+// the decode lands. Single-level textures stay mutable so StreamGlTexture
+// can resize them.
+unsigned int CreateGlTexture(ImageInfo const& info, MipmapMode mipmaps = MIPMAP_NONE) {
+    unsigned int texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+
+    int levels = GlTextureLevels(info, mipmaps);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, levels > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+    if (info.blockFormat) {
+        GLenum internalFormat = GetGlCompressedFormat(info.blockFormat);
+        if (GLEW_ARB_texture_storage) {
+            glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, info.w, info.h);
+        } else {
+            for (int level = 0; level < levels; ++level) {
+                int w = MipDimension(info.w, level), h = MipDimension(info.h, level);
+                glCompressedTexImage2D(GL_TEXTURE_2D, level, internalFormat, w, h, 0, (int)CompressedLevelSize(info.blockFormat, w, h), nullptr);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        }
+        return texture;
+    }
+
+    GLenum format;
+    GLenum internalFormat;
+    GetGlTextureFormat(info.channels, format, internalFormat, info.srgb, info.pixelType);
+    SetGlTextureSwizzle(info.channels);
+    if (levels == 1) {
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, info.w, info.h, 0, format, GetGlPixelType(info.pixelType), nullptr);
+    } else {
+        AllocateGlTextureStorage(internalFormat, format, info.w, info.h, levels);
+    }
+    return texture;
+}
+
+// Uploads into whatever texture is bound to GL_TEXTURE_2D.
+void UploadGlTextureLevels(Image const& img, MipmapMode mipmaps) {
+    if (img.blockFormat) {
+        GLenum internalFormat = GetGlCompressedFormat(img.blockFormat);
+        int levels = mipmaps == MIPMAP_NONE || img.levels < 1 ? 1 : img.levels;
+        for (int level = 0; level < levels; ++level) {
+            int w = MipDimension(img.w, level), h = MipDimension(img.h, level);
+            size_t size = CompressedLevelSize(img.blockFormat, w, h);
+            const unsigned char* blocks = img.data + CompressedLevelOffset(img.blockFormat, img.w, img.h, level);
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, internalFormat, (int)size, blocks);
+        }
+        return;
+    }
+
+    GLenum format;
+    GLenum internalFormat;
+    GetGlTextureFormat(img.channels, format, internalFormat, img.srgb, img.pixelType);
+    int levels = mipmaps == MIPMAP_NONE ? 1 : MipLevelCount(img.w, img.h);
+
+    // Small levels (and odd RGB widths) have rows that are not 4-byte multiples.
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    int uploadLevels = (mipmaps == MIPMAP_CPU && img.levels == levels) ? levels : 1;
+    for (int level = 0; level < uploadLevels; ++level) {
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, MipDimension(img.w, level), MipDimension(img.h, level), format,
+                        GetGlPixelType(img.pixelType), img.data + MipLevelOffset(img.w, img.h, TexelBytes(img.pixelType, img.channels), level));
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (uploadLevels < levels) {
+        glGenerateMipmap(GL_TEXTURE_2D);
+    }
+}
+
+// Fills storage made by CreateGlTexture for the same image and mipmaps. The
+// texture is bound on the active unit only for the upload; whatever was bound
+// there (e.g. by a draw that samples the unit) is bound again afterwards.
+void UploadGlTexture(unsigned int texture, Image const& img, MipmapMode mipmaps = MIPMAP_NONE) {
+    int previous = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    UploadGlTextureLevels(img, mipmaps);
+    glBindTexture(GL_TEXTURE_2D, previous);
+}
+
+ImageInfo GetImageInfo(Image const& img) {
+    return {img.w, img.h, img.channels, img.levels, img.blockFormat, img.srgb, img.pixelType};
+}
+
+unsigned int LoadGlTexture(Image img, unsigned int slot = 0, MipmapMode mipmaps = MIPMAP_NONE) {
+    unsigned int texture = CreateGlTexture(GetImageInfo(img), mipmaps);
+    UploadGlTexture(texture, img, mipmaps);
+    glActiveTexture(GL_TEXTURE0 + slot);
+    return texture;
+}
+
+// Estimated GPU footprint of CreateGlTexture(info, mipmaps). Drivers store
+// RGB8 as RGBA8 (and RGB16F as RGBA16F), so 3-channel texels count as 4.
+size_t GlTextureBytes(ImageInfo const& info, MipmapMode mipmaps) {
+    int levels = GlTextureLevels(info, mipmaps);
+    int texelBytes = TexelBytes(info.pixelType, info.channels == 3 ? 4 : info.channels);
+    size_t bytes = 0;
+    for (int level = 0; level < levels; ++level) {
+        int w = MipDimension(info.w, level), h = MipDimension(info.h, level);
+        bytes += info.blockFormat ? CompressedLevelSize(info.blockFormat, w, h) : (size_t)w*h*texelBytes;
+    }
+    return bytes;
+}
+
+// Upload scheduling: texture and buffer uploads that can wait are queued with
+// a priority and drained once per frame, highest first, until the frame's
+// byte budget is spent. The budget follows from a time budget and the upload
+// throughput measured over previous frames: the whole upload phase is timed
+// on the CPU and, through GL_TIME_ELAPSED queries read back a few frames
+// later, on the GPU, taking whichever is slower. Incremental uploaders
+// (progressive textures) draw on the same budget with ChargeUploadBudget.
+#define UPLOAD_BUDGET_MS_DEFAULT    2.0f
+#define UPLOAD_BUDGET_BYTES_DEFAULT ((size_t)2 << 20) // before the first timing, and with budgetMs == 0
+#define UPLOAD_TIMER_QUERIES        4 // frames of GPU timings in flight
+#define UPLOAD_MIN_TIMED_BYTES      (64u << 10) // smaller frames say more about overhead than throughput
+
+struct UploadJob {
+    int priority;
+    uint64_t sequence;
+    size_t bytes;
+    function<void()> upload;
+
+    // Heap order as in ThreadPool::Job: lower priority, then later submission, sinks.
+    bool operator<(UploadJob const& other) const {
+        return priority != other.priority ? priority < other.priority : sequence > other.sequence;
+    }
+};
+
+struct UploadTiming {
+    unsigned int query;
+    bool pending;
+    size_t bytes;
+    double cpuMs;
+};
+
+struct UploadScheduler {
+    float budgetMs = UPLOAD_BUDGET_MS_DEFAULT; // 0: a fixed budgetBytes per frame
+    size_t budgetBytes = UPLOAD_BUDGET_BYTES_DEFAULT;
+    double bytesPerMs = 0; // measured throughput, 0 until the first timing lands
+
+    vector<UploadJob> jobs; // binary heap, see UploadJob::operator<
+    uint64_t submitted = 0;
+
+    size_t remaining = 0; // bytes left in this frame's budget
+    size_t frameBytes = 0;
+    chrono::steady_clock::time_point frameStart;
+    UploadTiming timings[UPLOAD_TIMER_QUERIES] = {};
+    int nextTiming = 0;
+
+    size_t lastFrameBytes = 0; // for the stats line
+    float lastFrameMs = 0;
+};
+
+// upload runs on the GL thread in a later (or this) frame's EndUploadFrame.
+// bytes is what it sends, for the budget; jobs bigger than a whole frame's
+// budget still run, alone.
+void ScheduleUpload(UploadScheduler& scheduler, int priority, size_t bytes, function<void()> upload) {
+    scheduler.jobs.push_back({priority, scheduler.submitted++, bytes, std::move(upload)});
+    push_heap(scheduler.jobs.begin(), scheduler.jobs.end());
+}
+
+// Counts bytes an incremental uploader sent against this frame's budget.
+void ChargeUploadBudget(UploadScheduler& scheduler, size_t bytes) {
+    scheduler.remaining -= min(scheduler.remaining, bytes);
+    scheduler.frameBytes += bytes;
+}
+
+void AddUploadThroughputSample(UploadScheduler& scheduler, size_t bytes, double ms) {
+    if (bytes < UPLOAD_MIN_TIMED_BYTES || ms <= 0) {
+        return;
+    }
+    double sample = bytes/ms;
+    scheduler.bytesPerMs = scheduler.bytesPerMs > 0 ? 0.8*scheduler.bytesPerMs + 0.2*sample : sample;
+}
+
+// Starts the frame's upload phase: folds in finished GPU timings, sets the
+// byte budget and starts timing. Uploads issued until EndUploadFrame count.
+void BeginUploadFrame(UploadScheduler& scheduler) {
+    if (GLEW_ARB_timer_query) {
+        for (auto& timing : scheduler.timings) {
+            if (!timing.pending) {
+                continue;
+            }
+            int available = 0;
+            glGetQueryObjectiv(timing.query, GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available) {
+                GLuint64 gpuNs = 0;
+                glGetQueryObjectui64v(timing.query, GL_QUERY_RESULT, &gpuNs);
+                AddUploadThroughputSample(scheduler, timing.bytes, max(gpuNs/1e6, timing.cpuMs));
+                timing.pending = false;
+            }
+        }
+    }
+
+    bool timed = scheduler.budgetMs > 0 && scheduler.bytesPerMs > 0;
+    scheduler.remaining = timed ? (size_t)(scheduler.budgetMs*scheduler.bytesPerMs) : scheduler.budgetBytes;
+    scheduler.frameBytes = 0;
+    scheduler.frameStart = chrono::steady_clock::now();
+
+    // A slot whose result never came back is reused rather than waited on.
+    UploadTiming& timing = scheduler.timings[scheduler.nextTiming];
+    if (GLEW_ARB_timer_query) {
+        if (!timing.query) {
+            glGenQueries(1, &timing.query);
+        }
+        glBeginQuery(GL_TIME_ELAPSED, timing.query);
+    }
+}
+
+// Drains queued jobs into what is left of the budget (at least one job a
+// frame, so nothing starves), then closes the timing started by BeginUploadFrame.
+void EndUploadFrame(UploadScheduler& scheduler) {
+    for (bool first = true; !scheduler.jobs.empty(); first = false) {
+        UploadJob& next = scheduler.jobs.front();
+        if (!first && next.bytes > scheduler.remaining) {
+            break;
+        }
+        pop_heap(scheduler.jobs.begin(), scheduler.jobs.end());
+        UploadJob job = std::move(scheduler.jobs.back());
+        scheduler.jobs.pop_back();
+        job.upload();
+        ChargeUploadBudget(scheduler, job.bytes);
+    }
+
+    double cpuMs = chrono::duration<double, milli>(chrono::steady_clock::now() - scheduler.frameStart).count();
+    UploadTiming& timing = scheduler.timings[scheduler.nextTiming];
+    if (GLEW_ARB_timer_query) {
+        glEndQuery(GL_TIME_ELAPSED);
+        timing.pending = true;
+        timing.bytes = scheduler.frameBytes;
+        timing.cpuMs = cpuMs;
+        scheduler.nextTiming = (scheduler.nextTiming + 1) % UPLOAD_TIMER_QUERIES;
+    } else {
+        AddUploadThroughputSample(scheduler, scheduler.frameBytes, cpuMs);
+    }
+    scheduler.lastFrameBytes = scheduler.frameBytes;
+    scheduler.lastFrameMs = (float)cpuMs;
+}
+
+// Runs whatever is still queued (jobs may own buffers they free once
+// uploaded), so call it before tearing down what the jobs upload into.
+void DestroyUploadScheduler(UploadScheduler& scheduler) {
+    for (auto& job : scheduler.jobs) {
+        job.upload();
+    }
+    for (auto& timing : scheduler.timings) {
+        glDeleteQueries(1, &timing.query);
+    }
+    scheduler = {};
+}
+
+// Progressive uploads: a texture first shows a 1/8-scale JPEG decode (kept as
+// a thumbnail by the decoded-texture cache like any other decode) as its
+// coarse mips, then the full decode streams in the finer levels the preview
+// did not cover, coarsest first, within the UploadScheduler's per-frame
+// budget, with GL_TEXTURE_BASE_LEVEL following the finest complete level.
+// Content shows up within a frame or two and big images no longer land as one
+// upload spike.
+#define PROGRESSIVE_PREVIEW_PRIORITY_BOOST 1000 // previews decode before any full image
+
+struct ProgressiveTexture {
+    int flags; // ImageLoadFlags of the full decode, IMAGE_LOAD_MIPS included
+    ImageInfo info; // the texture's storage; channels follow the first decode to land
+    unsigned int texture;
+    int previewLevel; // texture level the preview's base lands on, 0 without a preview
+    future<Image> preview, full;
+    Image image; // full decode, uploaded a band of rows at a time
+    int level, row; // next band
+    int baseLevel; // finest complete level, the level count until a decode lands
+    bool done;
+};
+
+// Probes path and queues its decodes, before GL is even up; the preview only
+// when the format has a cheaper reduced-scale decode (JPEG, not yet at 1/8).
+// path must outlive the decodes.
+bool StartProgressiveTexture(ProgressiveTexture& pt, ThreadPool& pool, const char* path, int flags, int priority = 0) {
+    pt.flags = flags | IMAGE_LOAD_MIPS;
+    if (!ProbeImage(path, pt.flags, pt.info)) {
+        return false;
+    }
+
+    int previewFlags = pt.flags | IMAGE_LOAD_JPEG_EIGHTH;
+    ImageInfo previewInfo;
+    pt.previewLevel = 0;
+    if (previewFlags != pt.flags && ProbeImage(path, previewFlags, previewInfo) && previewInfo.w < pt.info.w) {
+        pt.previewLevel = JpegScaleShift(previewFlags) - JpegScaleShift(pt.flags);
+        pt.preview = ReadImageAsync(pool, path, previewFlags, priority + PROGRESSIVE_PREVIEW_PRIORITY_BOOST);
+    }
+    pt.full = ReadImageAsync(pool, path, pt.flags, priority);
+    return true;
+}
+
+// Creates the texture on the active unit with only its coarsest level
+// defined, as zeros, so until a decode lands it samples as black rather than
+// whatever the driver left in the storage.
+void CreateProgressiveTexture(ProgressiveTexture& pt) {
+    pt.texture = CreateGlTexture(pt.info, MIPMAP_CPU);
+    int levels = GlTextureLevels(pt.info, MIPMAP_CPU);
+    int w = MipDimension(pt.info.w, levels - 1), h = MipDimension(pt.info.h, levels - 1);
+    if (pt.info.blockFormat) {
+        vector<unsigned char> zeros(CompressedLevelSize(pt.info.blockFormat, w, h));
+        glCompressedTexSubImage2D(GL_TEXTURE_2D, levels - 1, 0, 0, w, h, GetGlCompressedFormat(pt.info.blockFormat),
+                                  (int)zeros.size(), zeros.data());
+    } else {
+        GLenum format, internalFormat;
+        GetGlTextureFormat(pt.info.channels, format, internalFormat, pt.info.srgb, pt.info.pixelType);
+        vector<unsigned char> zeros((size_t)w*h*TexelBytes(pt.info.pixelType, pt.info.channels));
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        glTexSubImage2D(GL_TEXTURE_2D, levels - 1, 0, 0, w, h, format, GetGlPixelType(pt.info.pixelType), zeros.data());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    }
+    pt.baseLevel = levels;
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levels - 1);
+}
+
+// IMAGE_LOAD_REDUCE_FORMAT decides channels from the pixels (and
+// IMAGE_LOAD_HDR may pack them), so the first decode to land may need a
+// smaller texture than the probe allowed for.
+void MatchProgressiveTextureFormat(ProgressiveTexture& pt, Image const& img) {
+    if (img.channels != pt.info.channels || img.pixelType != pt.info.pixelType) {
+        glDeleteTextures(1, &pt.texture);
+        pt.info.channels = img.channels;
+        pt.info.pixelType = img.pixelType;
+        CreateProgressiveTexture(pt);
+    }
+}
+
+void UploadProgressivePreview(ProgressiveTexture& pt, Image const& preview, UploadScheduler& scheduler) {
+    int levels = GlTextureLevels(pt.info, MIPMAP_CPU);
+    GLenum format, internalFormat;
+    GetGlTextureFormat(preview.channels, format, internalFormat, preview.srgb);
+    glBindTexture(GL_TEXTURE_2D, pt.texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    // The preview rounds its size up where the texture's levels round down,
+    // so each level is cropped to fit.
+    for (int level = pt.previewLevel; level < levels; ++level) {
+        int k = level - pt.previewLevel;
+        int w = MipDimension(pt.info.w, level), h = MipDimension(pt.info.h, level);
+        if (k >= preview.levels || MipDimension(preview.w, k) < w || MipDimension(preview.h, k) < h) {
+            break;
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, MipDimension(preview.w, k));
+        glTexSubImage2D(GL_TEXTURE_2D, level, 0, 0, w, h, format, GL_UNSIGNED_BYTE,
+                        preview.data + MipLevelOffset(preview.w, preview.h, preview.channels, k));
+        ChargeUploadBudget(scheduler, (size_t)w*h*preview.channels);
+        if (level == levels - 1 && pt.previewLevel < pt.baseLevel) {
+            pt.baseLevel = pt.previewLevel;
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, pt.baseLevel);
+        }
+    }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+// Called once per frame on the GL thread, between BeginUploadFrame and
+// EndUploadFrame, uploading as much as is left of scheduler's budget. Each
+// texture still gets at least one band of rows a frame, so none starves.
+// pt.texture may be replaced (see MatchProgressiveTextureFormat). Returns true
+// once the whole chain is uploaded (or the decode failed to match the probe).
+bool PumpProgressiveTexture(ProgressiveTexture& pt, UploadScheduler& scheduler) {
+    if (pt.done) {
+        return true;
+    }
+
+    if (!pt.image.data && pt.full.valid() && IsReady(pt.full)) {
+        pt.image = pt.full.get();
+        if (pt.image.w != pt.info.w || pt.image.h != pt.info.h) {
+            cerr << "ProgressiveTexture: image changed between ProbeImage and ReadImage\n";
+            FreeImage(pt.image);
+            pt.image = {};
+            pt.done = true;
+        } else if (pt.image.blockFormat || pt.image.pixelType != PIXEL_TYPE_U8) {
+            // Compressed levels go up whole, they are small anyway; high-precision
+            // images have no CPU chain to stream and get theirs from the GPU.
+            MatchProgressiveTextureFormat(pt, pt.image);
+            glBindTexture(GL_TEXTURE_2D, pt.texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+            UploadGlTexture(pt.texture, pt.image, MIPMAP_CPU);
+            ChargeUploadBudget(scheduler, GlTextureBytes(pt.info, MIPMAP_NONE));
+            FreeImage(pt.image);
+            pt.image = {};
+            pt.done = true;
+        } else {
+            // Levels a preview already filled are not uploaded again.
+            MatchProgressiveTextureFormat(pt, pt.image);
+            pt.level = pt.baseLevel - 1;
+            pt.row = 0;
+        }
+    }
+
+    if (pt.preview.valid() && IsReady(pt.preview)) {
+        Image preview = pt.preview.get();
+        // Too late once the full decode is in.
+        if (!pt.image.data && !pt.done) {
+            MatchProgressiveTextureFormat(pt, preview);
+            UploadProgressivePreview(pt, preview, scheduler);
+        }
+        FreeImage(preview);
+    }
+
+    if (pt.image.data) {
+        Image const& img = pt.image;
+        GLenum format, internalFormat;
+        GetGlTextureFormat(img.channels, format, internalFormat, img.srgb);
+        glBindTexture(GL_TEXTURE_2D, pt.texture);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        for (bool first = true; pt.level >= 0 && (scheduler.remaining > 0 || first); first = false) {
+            int w = MipDimension(img.w, pt.level), h = MipDimension(img.h, pt.level);
+            size_t rowBytes = (size_t)w*img.channels;
+            int rows = (int)min<size_t>(max<size_t>(scheduler.remaining/rowBytes, 1), h - pt.row);
+            glTexSubImage2D(GL_TEXTURE_2D, pt.level, 0, pt.row, w, rows, format, GL_UNSIGNED_BYTE,
+                            img.data + MipLevelOffset(img.w, img.h, img.channels, pt.level) + pt.row*rowBytes);
+            ChargeUploadBudget(scheduler, rows*rowBytes);
+            pt.row += rows;
+            if (pt.row == h) {
+                if (pt.level < pt.baseLevel) {
+                    pt.baseLevel = pt.level;
+                    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, pt.baseLevel);
+                }
+                --pt.level;
+                pt.row = 0;
+            }
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        if (pt.level < 0) {
+            FreeImage(pt.image);
+            pt.image = {};
+            pt.done = true;
+        }
+    }
+
+    // A preview still decoding is waited for here rather than leaked.
+    if (pt.done && pt.preview.valid()) {
+        FreeImage(pt.preview.get());
+    }
+    return pt.done;
+}
+
+void GlClearErrors() {
+    while (glGetError());
+}
+
+bool IsDebuggerPresent()
+{
+    static bool underDebugger = false;
+    static bool isCheckedAlready = false;
+
+    if (!isCheckedAlready)
+    {
+        if (ptrace(PTRACE_TRACEME, 0, 1, 0) < 0) {
+             underDebugger = true;
+        } else {
+            ptrace(PTRACE_DETACH, 0, 1, 0);
+        }
+        isCheckedAlready = true;
+    }
+    return underDebugger;
+}
+
+void GlPrintErrors(const char* file, const int line, const char* message) {
+    while (GLenum error = glGetError()) {
+        cerr << "[GL_CHECK ERROR] " << file << ":" << line << " " << message << ": " << hex << error << "\n";
+        if (IsDebuggerPresent()) {
+            __builtin_debugtrap();
+        }
+    }
+}
+
+#define GL_CHECK(x) \
+    if (true) { \
+        GlClearErrors(); \
+        x; \
+        GlPrintErrors(__FILE__, __LINE__, #x); \
+    } else
+
+unsigned int CreateGlShader(unsigned int type, string_view sourceCode) {
+    unsigned int shader = glCreateShader(type);
+    const char* sourceCodeData = sourceCode.data();
+    int sourceCodeLength = (int)sourceCode.size();
+    glShaderSource(shader, 1, &sourceCodeData, &sourceCodeLength);
+    glCompileShader(shader);
+
+    int result; glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
+    if (!result) {
+        int len; glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
+        char* message = (char*)alloca(len*sizeof(char));
+        glGetShaderInfoLog(shader, len, &len, message);
+        const char* shaderTypeStr = type == GL_VERTEX_SHADER ? "vertex" : (type == GL_FRAGMENT_SHADER ? "fragment" : "unknown");
+        cerr << "ERROR: CompileShader (" << shaderTypeStr << "): " << message << "\n";
+        exit(1);
+    }
+
+    return shader;
+}
+
+unsigned int CreateGlProgram(string_view vertexShader, string_view fragmentShader) {
+    unsigned int program = glCreateProgram();
+    unsigned int vs = CreateGlShader(GL_VERTEX_SHADER, vertexShader);
+    unsigned int fs = CreateGlShader(GL_FRAGMENT_SHADER, fragmentShader);
+
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+
+    int result;
+    glGetProgramiv(program, GL_LINK_STATUS, &result);
+    if (!result) {
+        int len;
+        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
+        char* message = (char*)alloca(len * sizeof(char));
+        glGetProgramInfoLog(program, len, &len, message);
+        cerr << "ERROR: LinkProgram: " << message << "\n";
+        exit(1);
+    }
+
+    glValidateProgram(program);
+
+    // FIXME: detach shaders too?
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+
+    return program;
+}
+
+unsigned int CreateGlVertexArray() {
+    unsigned int va;
+    glGenVertexArrays(1, &va);
+    glBindVertexArray(va);
+    return va;
+}
+
+unsigned int CreateGlBufferEx(void* data, size_t byteSize, GLenum target, GLenum dynamic) {
+    unsigned int buffer;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(target, buffer);
+    glBufferData(target, byteSize, data, dynamic);
+    return buffer;
+}
+#define CreateGlBuffer(data, target, dynamic) CreateGlBufferEx(data, sizeof(data), target, dynamic)
+
+unsigned int GetGlTypeSize(unsigned int glType) {
+    unsigned int glTypeSize = 0;
+    switch (glType) {
+        case GL_FLOAT: glTypeSize = 4; break;
+        default: assert(false && "unknown targetSize");
+    }
+    return glTypeSize;
+}
+
+void EnableGlVertexAttribArray(initializer_list<GlVertexAttrib> vertexAttributes) {
+    unsigned int stride = 0;
+    for (auto const& attrib : vertexAttributes) {
+        stride += attrib.count*GetGlTypeSize(attrib.glType);
+    }
+
+    size_t offset = 0;
+    unsigned int i = 0;
+    for (auto const& attrib : vertexAttributes) {
+        glEnableVertexAttribArray(i);
+        glVertexAttribPointer(i, attrib.count, attrib.glType, GL_FALSE, stride, (void*)offset);
+        offset += attrib.count*GetGlTypeSize(attrib.glType);
+        ++i;
+    }
+
+    assert(offset == stride);
+}
+
+// GPU-driven animation: quads uploaded once to a GL_STATIC_DRAW buffer, each
+// carrying its motion in its vertices, which animatedVertexShader.glsl
+// evaluates from a time uniform. Ambient motion then costs one glUniform1f a
+// frame and no uploads, however many quads move. The motion is a vertical
+// bob: at time t the quad sits amplitude*ease((1 + sin(frequency*t + phase))/2)
+// below where it was created.
+struct Motion {
+    float amplitude;
+    float frequency; // radians per second
+    float phase;
+    float easing; // EasingCurve, as a float attribute like texID
+};
+struct AnimatedVertex { Vertex vertex; Motion motion; };
+struct AnimatedQuad { AnimatedVertex tl, tr, br, bl; };
+
+AnimatedQuad CreateAnimatedQuad(float x, float y, float size, Color color, float texID, Motion motion) {
+    Quad quad = CreateQuad(x, y, size, color, texID);
+    return {{quad.tl, motion}, {quad.tr, motion}, {quad.br, motion}, {quad.bl, motion}};
+}
+
+struct AnimatedMesh {
+    unsigned int vertexArray;
+    unsigned int vertexBuffer;
+    unsigned int indexBuffer;
+    int indexCount;
+};
+
+// Two triangles per quad, for quads stored as tl, tr, br, bl.
+vector<unsigned int> CreateQuadIndices(size_t count) {
+    vector<unsigned int> indices;
+    indices.reserve(count*6);
+    for (unsigned int i = 0; i < count; ++i) {
+        for (unsigned int corner : {0, 1, 3, 1, 2, 3}) {
+            indices.push_back(i*4 + corner);
+        }
+    }
+    return indices;
+}
+
+// Uploads the quads (and their indices) once, with the CPU path's vertex
+// layout plus aMotion at location 4.
+void CreateAnimatedMesh(AnimatedMesh& mesh, span<const AnimatedQuad> quads) {
+    vector<unsigned int> indices = CreateQuadIndices(quads.size());
+    mesh.vertexArray = CreateGlVertexArray();
+    mesh.vertexBuffer = CreateGlBufferEx((void*)quads.data(), quads.size_bytes(), GL_ARRAY_BUFFER, GL_STATIC_DRAW);
+    EnableGlVertexAttribArray({
+        {GL_FLOAT, 2},
+        {GL_FLOAT, 2},
+        {GL_FLOAT, 4},
+        {GL_FLOAT, 1},
+        {GL_FLOAT, 4},
+    });
+    mesh.indexBuffer = CreateGlBufferEx(indices.data(), indices.size()*sizeof(unsigned int), GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW);
+    mesh.indexCount = (int)indices.size();
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// count small quads scattered over clip space, each with its own motion.
+vector<AnimatedQuad> CreateAmbientQuads(int count) {
+    minstd_rand random(1);
+    uniform_real_distribution<float> unit(0.0f, 1.0f);
+    vector<AnimatedQuad> quads(count);
+    for (auto& quad : quads) {
+        Color color = {unit(random), unit(random), unit(random), 0.5f};
+        Motion motion = {0.02f + 0.1f*unit(random), 0.5f + 4.0f*unit(random), 6.2831853f*unit(random),
+                         (float)(random() % EASING_CURVE_COUNT)};
+        quad = CreateAnimatedQuad(2.0f*unit(random) - 1.0f, 2.0f*unit(random) - 1.0f, 0.01f, color, (float)(random() % 2), motion);
+    }
+    return quads;
+}
+
+// program is the animatedVertexShader.glsl one, with its other uniforms set.
+void DrawAnimatedMesh(AnimatedMesh const& mesh, unsigned int program, float time) {
+    glUniform1f(glGetUniformLocation(program, "uTime"), time);
+    glBindVertexArray(mesh.vertexArray);
+    GL_CHECK(glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_INT, nullptr));
+}
+
+void DestroyAnimatedMesh(AnimatedMesh& mesh) {
+    glDeleteVertexArrays(1, &mesh.vertexArray);
+    glDeleteBuffers(1, &mesh.vertexBuffer);
+    glDeleteBuffers(1, &mesh.indexBuffer);
+    mesh = {};
+}
+
+// CPU-driven animation, for quads gameplay code moves: each quad's vertical
+// offset is a tween track (tween.h), evaluated in batches on the pool, and
+// each batch is written straight into the quads it moves before the whole
+// buffer is uploaded. The ambient field uses it in place of
+// animatedVertexShader.glsl when GPU animation is off.
+struct TweenedQuads {
+    vector<Quad> rest; // at offset 0
+    TweenTracks offsets; // one per quad
+    vector<float> values;
+    vector<Quad> quads; // rest moved by values, uploaded every frame
+    unsigned int vertexArray;
+    unsigned int vertexBuffer;
+    unsigned int indexBuffer;
+};
+
+// The same motion as AnimatedQuad's, as TWEEN_WAVE tracks: a period of
+// 2*pi/frequency, started phase/frequency early.
+void CreateTweenedQuads(TweenedQuads& tq, span<const AnimatedQuad> quads) {
+    tq.rest.resize(quads.size());
+    for (size_t i = 0; i < quads.size(); ++i) {
+        AnimatedQuad const& quad = quads[i];
+        tq.rest[i] = {quad.tl.vertex, quad.tr.vertex, quad.br.vertex, quad.bl.vertex};
+        Motion const& motion = quad.tl.motion;
+        AddTween(tq.offsets, 0.0f, -motion.amplitude, -motion.phase/motion.frequency, 6.2831853f/motion.frequency, TWEEN_WAVE,
+                 (EasingCurve)motion.easing);
+    }
+    tq.values.resize(quads.size());
+    tq.quads = tq.rest;
+
+    vector<unsigned int> indices = CreateQuadIndices(quads.size());
+    tq.vertexArray = CreateGlVertexArray();
+    tq.vertexBuffer = CreateGlBufferEx(tq.quads.data(), tq.quads.size()*sizeof(Quad), GL_ARRAY_BUFFER, GL_STREAM_DRAW);
+    EnableGlVertexAttribArray({
+        {GL_FLOAT, 2},
+        {GL_FLOAT, 2},
+        {GL_FLOAT, 4},
+        {GL_FLOAT, 1},
+    });
+    tq.indexBuffer = CreateGlBufferEx(indices.data(), indices.size()*sizeof(unsigned int), GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW);
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Evaluates and rebuilds every quad for time on the pool, then uploads them.
+void UpdateTweenedQuads(TweenedQuads& tq, ThreadPool& pool, float time) {
+    EvaluateTweensParallel(pool, tq.offsets, time, tq.values.data(), [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            Quad& quad = tq.quads[i];
+            quad = tq.rest[i];
+            float offset = tq.values[i];
+            quad.tl.y += offset;
+            quad.tr.y += offset;
+            quad.br.y += offset;
+            quad.bl.y += offset;
+        }
+    });
+    glBindBuffer(GL_ARRAY_BUFFER, tq.vertexBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, tq.quads.size()*sizeof(Quad), tq.quads.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Draws with the bound program (vertexShader.glsl's, uniforms set).
+void DrawTweenedQuads(TweenedQuads const& tq) {
+    glBindVertexArray(tq.vertexArray);
+    GL_CHECK(glDrawElements(GL_TRIANGLES, (int)tq.quads.size()*6, GL_UNSIGNED_INT, nullptr));
+}
+
+void DestroyTweenedQuads(TweenedQuads& tq) {
+    glDeleteVertexArrays(1, &tq.vertexArray);
+    glDeleteBuffers(1, &tq.vertexBuffer);
+    glDeleteBuffers(1, &tq.indexBuffer);
+    tq = {};
+}
+
+// Texture streaming: uploads that must not stall the frame go through a small
+// pool of GL_PIXEL_UNPACK_BUFFERs. The GL thread maps a buffer sized from the
+// image header, a worker decodes into the mapping, and once the decode is done
+// the GL thread unmaps it and issues glTexSubImage2D from the buffer, which the
+// driver can DMA asynchronously. A fence tells us when the buffer is reusable.
+// The glTexSubImage2D itself waits its turn in the UploadScheduler.
+#define TEXTURE_STREAM_PBO_COUNT 4
+
+struct PixelUnpackBuffer {
+    unsigned int buffer;
+    size_t capacity;
+    GLsync fence; // last upload reading from this buffer
+    bool inUse;
+};
+
+// Called on the GL thread once a stream's upload has landed, with the texture
+// and what it now holds; texture is 0 if the decode or upload failed.
+typedef function<void(unsigned int texture, ImageInfo const& info)> TextureStreamCallback;
+
+struct TextureStreamJob {
+    string path;
+    int flags; // ImageLoadFlags, minus IMAGE_LOAD_MIPS (the GPU rebuilds the chain)
+    unsigned int texture; // 0: created by the upload, from the decoded format
+    MipmapMode mipmaps; // for a texture created by the upload
+    int w, h, channels; // channels is probed as an upper bound, then set from the decode
+    int priority; // in the UploadScheduler
+    PixelUnpackBuffer* pbo;
+    future<int> decoded; // channels written to the buffer, 0 on failure
+    TextureStreamCallback uploaded;
+};
+
+struct TextureStreamer {
+    PixelUnpackBuffer pbos[TEXTURE_STREAM_PBO_COUNT];
+    deque<TextureStreamJob> waiting; // no free buffer yet
+    vector<TextureStreamJob> decoding;
+};
+
+// Readies pbo for size bytes, left bound, once the GPU has finished reading
+// it. Returns false (without blocking) while its last upload is in flight.
+bool ReclaimPixelUnpackBuffer(PixelUnpackBuffer& pbo, size_t size) {
+    if (pbo.fence) {
+        if (glClientWaitSync(pbo.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            return false;
+        }
+        glDeleteSync(pbo.fence);
+        pbo.fence = nullptr;
+    }
+    if (!pbo.buffer) {
+        glGenBuffers(1, &pbo.buffer);
+    }
+
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo.buffer);
+    if (pbo.capacity < size) {
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+        pbo.capacity = size;
+    }
+    return true;
+}
+
+PixelUnpackBuffer* AcquirePixelUnpackBuffer(TextureStreamer& streamer, size_t size) {
+    for (auto& pbo : streamer.pbos) {
+        if (!pbo.inUse && ReclaimPixelUnpackBuffer(pbo, size)) {
+            pbo.inUse = true;
+            return &pbo;
+        }
+    }
+    return nullptr;
+}
+
+void StartTextureStreamJob(TextureStreamer& streamer, ThreadPool& pool, TextureStreamJob& job) {
+    size_t size = (size_t)job.w*job.h*job.channels;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.pbo->buffer);
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    assert(mapped);
+
+    // The decoder writes straight into the mapping, no staging copy.
+    string path = job.path;
+    int flags = job.flags, w = job.w, h = job.h, channels = job.channels;
+    job.decoded = pool.Submit([path, flags, mapped, size, w, h, channels] {
+        Image img = ReadImage(path.c_str(), flags, (unsigned char*)mapped, size);
+        // IMAGE_LOAD_REDUCE_FORMAT may leave fewer channels than probed.
+        bool ok = img.w == w && img.h == h && img.channels <= channels;
+        if (!ok) {
+            cerr << "StreamGlTexture: " << path << " changed while streaming\n";
+        }
+        FreeImage(img);
+        return ok ? img.channels : 0;
+    });
+    streamer.decoding.push_back(std::move(job));
+}
+
+// Probes path for job, exiting if it cannot be streamed.
+ImageInfo ProbeTextureStreamJob(TextureStreamJob& job, const char* path, int flags, int priority) {
+    job.path = path;
+    job.flags = flags & ~IMAGE_LOAD_MIPS;
+    job.priority = priority;
+    ImageInfo info;
+    if (!ProbeImage(path, job.flags, info)) {
+        cerr << "StreamGlTexture: " << path << ": " << stbi_failure_reason() << "\n";
+        exit(1);
+    }
+    if (info.blockFormat || info.pixelType != PIXEL_TYPE_U8) {
+        cerr << "StreamGlTexture: " << path << ": block-compressed and high-precision textures are uploaded with LoadGlTexture\n";
+        exit(1);
+    }
+    job.w = info.w;
+    job.h = info.h;
+    job.channels = info.channels;
+    return info;
+}
+
+void QueueTextureStreamJob(TextureStreamer& streamer, ThreadPool& pool, TextureStreamJob& job) {
+    job.pbo = AcquirePixelUnpackBuffer(streamer, (size_t)job.w*job.h*job.channels);
+    if (job.pbo) {
+        StartTextureStreamJob(streamer, pool, job);
+    } else {
+        streamer.waiting.push_back(std::move(job));
+    }
+}
+
+// Streams the image at path into texture (created if 0), returning the texture
+// name right away. The texture keeps its old contents until the upload lands.
+// Pass the flags the texture was first loaded with so the format matches.
+unsigned int StreamGlTexture(TextureStreamer& streamer, ThreadPool& pool, const char* path, unsigned int texture = 0,
+                             int flags = IMAGE_LOAD_DEFAULT, int priority = 0, TextureStreamCallback uploaded = nullptr) {
+    TextureStreamJob job = {};
+    ImageInfo info = ProbeTextureStreamJob(job, path, flags, priority);
+    if (!texture) {
+        texture = CreateGlTexture(info);
+    }
+    job.texture = texture;
+    job.uploaded = std::move(uploaded);
+    QueueTextureStreamJob(streamer, pool, job);
+    return texture;
+}
+
+// Like StreamGlTexture, but the texture is only created once the pixels are
+// decoded, in the format they ended up in, and is handed to uploaded.
+void StreamNewGlTexture(TextureStreamer& streamer, ThreadPool& pool, const char* path, int flags, MipmapMode mipmaps,
+                        int priority, TextureStreamCallback uploaded) {
+    TextureStreamJob job = {};
+    ProbeTextureStreamJob(job, path, flags, priority);
+    job.mipmaps = mipmaps;
+    job.uploaded = std::move(uploaded);
+    QueueTextureStreamJob(streamer, pool, job);
+}
+
+// Unmaps the decoded buffer and copies it into the texture, from
+// EndUploadFrame. Frees the buffer for the next job either way. If the
+// buffer's contents were lost while it was mapped (glUnmapBuffer returns
+// GL_FALSE, e.g. across a display mode change), the image is streamed again.
+void UploadTextureStream(TextureStreamer& streamer, ThreadPool& pool, TextureStreamJob& job) {
+    bool ok = job.channels > 0;
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.pbo->buffer);
+    if (!glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER)) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        job.pbo->inUse = false;
+        cerr << "StreamGlTexture: " << job.path << ": upload buffer contents lost, decoding again\n";
+        TextureStreamJob retry = {};
+        ProbeTextureStreamJob(retry, job.path.c_str(), job.flags, job.priority);
+        retry.texture = job.texture;
+        retry.mipmaps = job.mipmaps;
+        retry.uploaded = std::move(job.uploaded);
+        QueueTextureStreamJob(streamer, pool, retry);
+        return;
+    }
+    ImageInfo info = {};
+    info.w = job.w;
+    info.h = job.h;
+    info.channels = job.channels;
+    info.srgb = job.flags & IMAGE_LOAD_SRGB;
+    int previous = 0;
+    glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+    if (ok && !job.texture) {
+        job.texture = CreateGlTexture(info, job.mipmaps);
+    }
+    if (ok) {
+        GLenum format, internalFormat;
+        GetGlTextureFormat(job.channels, format, internalFormat, info.srgb);
+
+        int texW = 0, texH = 0, texFormat = 0, immutable = 0, minFilter = 0;
+        glBindTexture(GL_TEXTURE_2D, job.texture);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &texW);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &texH);
+        glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_INTERNAL_FORMAT, &texFormat);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_IMMUTABLE_FORMAT, &immutable);
+        glGetTexParameteriv(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, &minFilter);
+        bool sameShape = texW == job.w && texH == job.h && (GLenum)texFormat == internalFormat;
+
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (sameShape) {
+            GL_CHECK(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, job.w, job.h, format, GL_UNSIGNED_BYTE, nullptr));
+        } else if (!immutable) {
+            GL_CHECK(glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, job.w, job.h, 0, format, GL_UNSIGNED_BYTE, nullptr));
+            SetGlTextureSwizzle(job.channels);
+        } else {
+            cerr << "StreamGlTexture: " << job.path << " does not match the immutable storage of texture " << job.texture << "\n";
+            ok = false;
+        }
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+        // Mipmapped textures get their chain rebuilt from the new base level.
+        if (sameShape && minFilter != GL_LINEAR && minFilter != GL_NEAREST) {
+            glGenerateMipmap(GL_TEXTURE_2D);
+        }
+        job.pbo->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    glBindTexture(GL_TEXTURE_2D, previous);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    job.pbo->inUse = false;
+    if (job.uploaded) {
+        job.uploaded(ok ? job.texture : 0, info);
+    }
+}
+
+// Called once per frame on the GL thread. Never blocks on a decode; finished
+// decodes are queued on scheduler.
+void PumpTextureStreams(TextureStreamer& streamer, ThreadPool& pool, UploadScheduler& scheduler) {
+    for (size_t i = 0; i < streamer.decoding.size();) {
+        TextureStreamJob& job = streamer.decoding[i];
+        if (!IsReady(job.decoded)) {
+            ++i;
+            continue;
+        }
+
+        job.channels = job.decoded.get();
+        auto ready = make_shared<TextureStreamJob>(std::move(job));
+        ScheduleUpload(scheduler, ready->priority, (size_t)ready->w*ready->h*max(ready->channels, 0),
+                       [&streamer, &pool, ready] { UploadTextureStream(streamer, pool, *ready); });
+        streamer.decoding.erase(streamer.decoding.begin() + i);
+    }
+
+    while (!streamer.waiting.empty()) {
+        TextureStreamJob& job = streamer.waiting.front();
+        job.pbo = AcquirePixelUnpackBuffer(streamer, (size_t)job.w*job.h*job.channels);
+        if (!job.pbo) {
+            break;
+        }
+        StartTextureStreamJob(streamer, pool, job);
+        streamer.waiting.pop_front();
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+// Waits for in-flight decodes, since workers may still be writing into mapped buffers.
+void DestroyTextureStreamer(TextureStreamer& streamer) {
+    for (auto& job : streamer.decoding) {
+        job.decoded.wait();
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.pbo->buffer);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    streamer.decoding.clear();
+    streamer.waiting.clear();
+
+    for (auto& pbo : streamer.pbos) {
+        if (pbo.fence) {
+            glDeleteSync(pbo.fence);
+        }
+        glDeleteBuffers(1, &pbo.buffer);
+        pbo = {};
+    }
+}
+
+// Texture residency: managed textures are remembered by path and load flags,
+// so the least recently used ones can be deleted whenever the resident total
+// goes over the VRAM budget and loaded again the next time they are bound.
+// Reloads are streamed (through ReadImage on the pool, so usually from the
+// decoded-texture cache) and the texture binds as 0 until its upload lands.
+// The budget is enforced once per frame, never against textures bound that
+// frame or with a stream in flight.
+//
+// The manager is also a registry: user content is full of the same image
+// under different names, so textures are registered by a hash of the bytes
+// they decode from, and a duplicate gets the existing handle back with one
+// more reference. Duplicates so share one decode (whichever is in flight for
+// the handle), one GL texture and one place in the budget.
+#define TEXTURE_VRAM_BUDGET_DEFAULT ((size_t)256 << 20)
+
+// The hash only picks the candidates; the size and the flags have to match
+// as well before a texture is shared.
+struct TextureContentKey {
+    uint64_t hash; // of the source bytes
+    uint64_t size;
+    int flags; // ImageLoadFlags
+    MipmapMode mipmaps;
+
+    bool operator==(TextureContentKey const&) const = default;
+};
+
+struct ManagedTexture {
+    string path; // of the first registration
+    int flags; // ImageLoadFlags
+    MipmapMode mipmaps;
+    TextureContentKey key;
+    int refs; // 0 once released, when the handle is free for reuse
+    unsigned int texture; // 0 while evicted
+    size_t bytes; // GlTextureBytes while resident
+    uint64_t lastUse; // TextureResidency::frame of the last bind
+    bool pinned; // never evicted, e.g. while an upload into it is pending
+    bool streaming; // a StreamManagedGlTexture upload is in flight
+};
+
+struct TextureResidency {
+    size_t budget = TEXTURE_VRAM_BUDGET_DEFAULT;
+    size_t residentBytes = 0;
+    uint64_t frame = 0;
+    vector<ManagedTexture> textures; // indexed by the handles ManageGlTexture returns
+    vector<int> freeHandles;
+    unordered_multimap<uint64_t, int> byContent; // TextureContentKey::hash to handle
+    size_t evictions = 0, reloads = 0, duplicates = 0;
+};
+
+// Packed images are keyed by their stored pixels, everything else by the
+// file (or raw asset) bytes, so the key never needs a decode.
+TextureContentKey ImageContentKey(const char* path, int flags, MipmapMode mipmaps) {
+    TextureContentKey key = {};
+    key.flags = flags;
+    key.mipmaps = mipmaps;
+    if (auto entry = FindAsset(assetPack, path); entry && entry->kind == ASSET_IMAGE) {
+        auto bytes = AssetBytes(assetPack, *entry);
+        uint64_t shape[] = {entry->w, entry->h, entry->channels, entry->flags};
+        key.hash = HashBytes(bytes.data(), bytes.size(), HashBytes(shape, sizeof(shape)));
+        key.size = bytes.size();
+    } else {
+        MappedFile file = ReadFile(path, MAP_FILE_DEFAULT);
+        key.hash = HashBytes(file.data, file.size);
+        key.size = file.size;
+    }
+    key.hash = HashMix(key.hash ^ (uint64_t)flags, (uint64_t)mipmaps + 1);
+    return key;
+}
+
+// Registers a texture without loading it; the first bind does. If one with
+// the same contents and flags is registered already, its handle is returned
+// with another reference instead, loaded or not.
+int ManageGlTexture(TextureResidency& residency, const char* path, int flags = IMAGE_LOAD_DEFAULT, MipmapMode mipmaps = MIPMAP_NONE) {
+    TextureContentKey key = ImageContentKey(path, flags, mipmaps);
+    auto [first, last] = residency.byContent.equal_range(key.hash);
+    for (auto it = first; it != last; ++it) {
+        ManagedTexture& managed = residency.textures[it->second];
+        if (managed.key == key) {
+            ++managed.refs;
+            ++residency.duplicates;
+            return it->second;
+        }
+    }
+
+    ManagedTexture managed = {};
+    managed.path = path;
+    managed.flags = flags;
+    managed.mipmaps = mipmaps;
+    managed.key = key;
+    managed.refs = 1;
+    int handle;
+    if (residency.freeHandles.empty()) {
+        handle = (int)residency.textures.size();
+        residency.textures.push_back(std::move(managed));
+    } else {
+        handle = residency.freeHandles.back();
+        residency.freeHandles.pop_back();
+        residency.textures[handle] = std::move(managed);
+    }
+    residency.byContent.emplace(key.hash, handle);
+    return handle;
+}
+
+void FreeManagedGlTexture(TextureResidency& residency, int handle) {
+    ManagedTexture& managed = residency.textures[handle];
+    glDeleteTextures(1, &managed.texture);
+    residency.residentBytes -= managed.bytes;
+    managed = {};
+    residency.freeHandles.push_back(handle);
+}
+
+// Drops a reference to the texture; the last one deletes it and frees the
+// handle, once a stream into it has landed. Not while it is pinned.
+void ReleaseGlTexture(TextureResidency& residency, int handle) {
+    ManagedTexture& managed = residency.textures[handle];
+    assert(managed.refs > 0 && !managed.pinned);
+    if (--managed.refs > 0) {
+        return;
+    }
+    auto [first, last] = residency.byContent.equal_range(managed.key.hash);
+    for (auto it = first; it != last; ++it) {
+        if (it->second == handle) {
+            residency.byContent.erase(it);
+            break;
+        }
+    }
+    if (!managed.streaming) {
+        FreeManagedGlTexture(residency, handle);
+    }
+}
+
+// Hands a texture created elsewhere (e.g. from ProbeImage ahead of an async
+// decode) to the manager. Whoever replaced the previous one has deleted it.
+void AdoptGlTexture(TextureResidency& residency, int handle, unsigned int texture, ImageInfo const& info) {
+    ManagedTexture& managed = residency.textures[handle];
+    residency.residentBytes -= managed.bytes;
+    managed.texture = texture;
+    managed.bytes = GlTextureBytes(info, managed.mipmaps);
+    residency.residentBytes += managed.bytes;
+}
+
+// Streams the texture's file in again: into the resident texture, or into a
+// new one if it was evicted (or never loaded). Its size is settled once the
+// upload lands, since format reduction may change it. Does nothing while
+// another upload into the texture is pending.
+void StreamManagedGlTexture(TextureResidency& residency, TextureStreamer& streamer, ThreadPool& pool, int handle, int priority = 0) {
+    ManagedTexture& managed = residency.textures[handle];
+    if (managed.streaming || managed.pinned) {
+        return;
+    }
+    managed.streaming = true;
+    TextureResidency* owner = &residency;
+    auto uploaded = [owner, handle](unsigned int texture, ImageInfo const& info) {
+        owner->textures[handle].streaming = false;
+        if (texture) {
+            AdoptGlTexture(*owner, handle, texture, info);
+        }
+        // Released while the stream was in flight.
+        if (!owner->textures[handle].refs) {
+            FreeManagedGlTexture(*owner, handle);
+        }
+    };
+    if (managed.texture) {
+        StreamGlTexture(streamer, pool, managed.path.c_str(), managed.texture, managed.flags, priority, uploaded);
+    } else {
+        StreamNewGlTexture(streamer, pool, managed.path.c_str(), managed.flags, managed.mipmaps, priority, uploaded);
+        ++residency.reloads;
+    }
 }
 
-void FreeImage(Image const& img) {
-    stbi_image_free(img.data);
+// Binds the texture to unit, which is left active, starting a reload if it
+// was evicted (or never loaded). Returns the texture name, which changes
+// across evictions and is 0 while a reload is in flight.
+unsigned int BindManagedGlTexture(TextureResidency& residency, TextureStreamer& streamer, ThreadPool& pool, int handle, unsigned int unit) {
+    ManagedTexture& managed = residency.textures[handle];
+    if (!managed.texture) {
+        StreamManagedGlTexture(residency, streamer, pool, handle);
+    }
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, managed.texture);
+    managed.lastUse = residency.frame;
+    return managed.texture;
 }
 
-unsigned int LoadGlTexture(Image img, unsigned int slot = 0) {
-    unsigned int texture;
+void EvictGlTexture(TextureResidency& residency, ManagedTexture& managed) {
+    glDeleteTextures(1, &managed.texture);
+    residency.residentBytes -= managed.bytes;
+    managed.texture = 0;
+    managed.bytes = 0;
+    ++residency.evictions;
+}
 
-    glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+// Called once per frame after drawing: evicts least recently used textures
+// until the resident total fits the budget. Textures bound this frame stay,
+// so a frame that needs more than the budget goes over it rather than thrash.
+void EndTextureResidencyFrame(TextureResidency& residency) {
+    if (residency.residentBytes > residency.budget) {
+        vector<ManagedTexture*> candidates;
+        for (auto& managed : residency.textures) {
+            if (managed.texture && !managed.pinned && !managed.streaming && managed.lastUse != residency.frame) {
+                candidates.push_back(&managed);
+            }
+        }
+        sort(candidates.begin(), candidates.end(), [](ManagedTexture* a, ManagedTexture* b) { return a->lastUse < b->lastUse; });
+        for (size_t i = 0; i < candidates.size() && residency.residentBytes > residency.budget; ++i) {
+            EvictGlTexture(residency, *candidates[i]);
+        }
+    }
+    ++residency.frame;
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+void DestroyTextureResidency(TextureResidency& residency) {
+    for (auto& managed : residency.textures) {
+        glDeleteTextures(1, &managed.texture);
+    }
+    residency = {};
+}
 
-    GLenum format;
-    GLenum internalFormat;
+// Animated textures: GIFs play back without decoding on the GL thread. A
+// worker composes frames one at a time (stbi_gif_stream) into a small ring of
+// pixel unpack buffers, running ahead of playback, and each display tick the
+// GL thread uploads at most one finished frame, once the previous frame's
+// delay has passed. A single-frame GIF stops decoding after its first frame.
+#define ANIMATED_TEXTURE_RING          3   // frames decoded ahead (or being shown from)
+#define ANIMATED_TEXTURE_MIN_DELAY_MS  20  // shorter delays play at the default, as browsers do
+#define ANIMATED_TEXTURE_DEFAULT_DELAY 100
+
+struct AnimationDecode {
+    int result; // stbi_gif_stream_next's
+    int delayMs;
+    bool looped; // rewound to the first frame
+    const char* error;
+};
 
-    if (img.channels == 1) {
-        format = GL_RED;
-        internalFormat = GL_R8;
-    } else if (img.channels == 3) {
-        format = GL_RGB;
-        internalFormat = GL_RGB8;
-    } else if (img.channels == 4) {
-        format = GL_RGBA;
-        internalFormat = GL_RGBA8;
-    } else {
-        cerr << "Unsupported channel count: " << img.channels << endl;
-        exit(1);
-    }
+struct AnimationFrame {
+    PixelUnpackBuffer pbo; // inUse from mapping until uploaded
+    future<AnimationDecode> decoded;
+    int delayMs;
+    bool ready; // unmapped, waiting for its turn
+};
 
-    glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, img.w, img.h, 0, format, GL_UNSIGNED_BYTE, img.data);
-    glActiveTexture(GL_TEXTURE0 + slot);
+struct AnimatedTexture {
+    string path;
+    MappedFile file;
+    stbi_gif_stream* stream;
+    int w, h;
+    unsigned int texture;
+    AnimationFrame frames[ANIMATED_TEXTURE_RING];
+    int decodeSlot, showSlot; // next to decode into, next to upload from
+    bool decoding; // frames[decodeSlot] is mapped and a worker owns the stream
+    double nextFrameTime; // when the frame on screen is due to be replaced
+    int frameCount; // frames per loop, once the first loop is decoded
+    int loopFrames; // decoded since the last rewind
+    bool finished; // single frame, or the stream went bad: nothing left to decode
+    size_t uploads;
+    size_t lateFrames; // shown a whole delay late, restarting the clock
+};
 
-    return texture;
+// Opens the GIF at path and creates its (still empty) RGBA texture on the
+// active unit. Prints why and returns false if path is not a GIF.
+bool OpenAnimatedTexture(AnimatedTexture& at, const char* path) {
+    at = {};
+    at.path = path;
+    at.file = ReadFile(path);
+    at.stream = stbi_gif_stream_open(at.file.data, (int)at.file.size, &at.w, &at.h);
+    if (!at.stream) {
+        cerr << "OpenAnimatedTexture: " << path << ": " << stbi_failure_reason() << "\n";
+        return false;
+    }
+    ImageInfo info = {};
+    info.w = at.w;
+    info.h = at.h;
+    info.channels = 4;
+    info.levels = 1;
+    at.texture = CreateGlTexture(info);
+    return true;
 }
 
-void GlClearErrors() {
-    while (glGetError());
+// Maps the next ring slot and composes the next frame into it on a worker.
+// The stream is only touched by that job until it is collected.
+void StartAnimationDecode(AnimatedTexture& at, ThreadPool& pool) {
+    AnimationFrame& frame = at.frames[at.decodeSlot];
+    size_t size = (size_t)at.w*at.h*4;
+    if (frame.pbo.inUse || !ReclaimPixelUnpackBuffer(frame.pbo, size)) {
+        return;
+    }
+    void* mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    assert(mapped);
+    frame.pbo.inUse = true;
+    at.decoding = true;
+
+    // With one frame decoded, the end of the stream means a still image: it
+    // is reported rather than rewound, so its frame is not decoded twice.
+    stbi_gif_stream* stream = at.stream;
+    bool flip = flipImagesOnLoad, loop = at.loopFrames > 1 || at.frameCount > 1;
+    frame.decoded = pool.Submit([stream, mapped, flip, loop] {
+        AnimationDecode decode = {};
+        decode.result = stbi_gif_stream_next(stream, (stbi_uc*)mapped, flip, &decode.delayMs);
+        if (decode.result == 0 && loop) {
+            stbi_gif_stream_rewind(stream);
+            decode.looped = true;
+            decode.result = stbi_gif_stream_next(stream, (stbi_uc*)mapped, flip, &decode.delayMs);
+        }
+        if (decode.result < 0 || (decode.result == 0 && !loop)) {
+            // stb's failure reason is per thread.
+            decode.error = decode.result < 0 ? stbi_failure_reason() : "no frames";
+        }
+        return decode;
+    });
 }
 
-bool IsDebuggerPresent()
-{
-    static bool underDebugger = false;
-    static bool isCheckedAlready = false;
+// Called once per frame on the GL thread with the display time in seconds,
+// between BeginUploadFrame and EndUploadFrame. Never blocks on a decode; the
+// frame upload is charged to scheduler but not deferred by it, since it is
+// due now.
+void PumpAnimatedTexture(AnimatedTexture& at, ThreadPool& pool, UploadScheduler& scheduler, double now) {
+    if (at.decoding && IsReady(at.frames[at.decodeSlot].decoded)) {
+        AnimationFrame& frame = at.frames[at.decodeSlot];
+        AnimationDecode decode = frame.decoded.get();
+        at.decoding = false;
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frame.pbo.buffer);
+        // GL_FALSE: the buffer's contents were lost while it was mapped.
+        bool intact = glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        if (decode.result > 0) {
+            if (decode.looped) {
+                at.frameCount = at.loopFrames;
+                at.loopFrames = 0;
+            }
+            ++at.loopFrames;
+            if (intact) {
+                frame.delayMs = decode.delayMs < ANIMATED_TEXTURE_MIN_DELAY_MS ? ANIMATED_TEXTURE_DEFAULT_DELAY : decode.delayMs;
+                frame.ready = true;
+                at.decodeSlot = (at.decodeSlot + 1) % ANIMATED_TEXTURE_RING;
+            } else {
+                // Every frame is the whole composed canvas, so the next one
+                // makes up for this one; its slot is decoded into again.
+                cerr << "PumpAnimatedTexture: " << at.path << ": frame buffer contents lost, skipping the frame\n";
+                frame.pbo.inUse = false;
+            }
+        } else if (decode.result == 0 && at.loopFrames == 1) {
+            // A still image: its only frame is already on its way.
+            at.frameCount = 1;
+            frame.pbo.inUse = false;
+            at.finished = true;
+        } else {
+            cerr << "PumpAnimatedTexture: " << at.path << ": " << decode.error << "\n";
+            frame.pbo.inUse = false;
+            at.finished = true;
+        }
+    }
 
-    if (!isCheckedAlready)
-    {
-        if (ptrace(PTRACE_TRACEME, 0, 1, 0) < 0) {
-             underDebugger = true;
+    AnimationFrame& shown = at.frames[at.showSlot];
+    if (shown.ready && now >= at.nextFrameTime) {
+        int previous = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+        glBindTexture(GL_TEXTURE_2D, at.texture);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, shown.pbo.buffer);
+        GL_CHECK(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, at.w, at.h, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glBindTexture(GL_TEXTURE_2D, previous);
+        shown.pbo.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        shown.pbo.inUse = false;
+        shown.ready = false;
+        ChargeUploadBudget(scheduler, (size_t)at.w*at.h*4);
+        ++at.uploads;
+
+        // Stay on the GIF's clock, unless the decode fell behind it (or this
+        // is the first frame): then restart it from now rather than rushing.
+        double delay = shown.delayMs/1000.0;
+        if (at.uploads > 1 && now - at.nextFrameTime < delay) {
+            at.nextFrameTime += delay;
         } else {
-            ptrace(PTRACE_DETACH, 0, 1, 0);
+            at.lateFrames += at.uploads > 1;
+            at.nextFrameTime = now + delay;
         }
-        isCheckedAlready = true;
+        at.showSlot = (at.showSlot + 1) % ANIMATED_TEXTURE_RING;
+    }
+
+    if (!at.decoding && !at.finished) {
+        StartAnimationDecode(at, pool);
     }
-    return underDebugger;
 }
 
-void GlPrintErrors(const char* file, const int line, const char* message) {
-    while (GLenum error = glGetError()) {
-        cerr << "[GL_CHECK ERROR] " << file << ":" << line << " " << message << ": " << hex << error << "\n";
-        if (IsDebuggerPresent()) {
-            __builtin_debugtrap();
+// Waits for the decode in flight, which writes into a mapped buffer and reads the file.
+void DestroyAnimatedTexture(AnimatedTexture& at) {
+    for (auto& frame : at.frames) {
+        if (frame.decoded.valid()) {
+            frame.decoded.wait();
         }
+        if (at.decoding && &frame == &at.frames[at.decodeSlot]) {
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, frame.pbo.buffer);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        }
+        if (frame.pbo.fence) {
+            glDeleteSync(frame.pbo.fence);
+        }
+        glDeleteBuffers(1, &frame.pbo.buffer);
     }
+    stbi_gif_stream_close(at.stream);
+    glDeleteTextures(1, &at.texture);
+    at = {};
 }
 
-#define GL_CHECK(x) \
-    if (true) { \
-        GlClearErrors(); \
-        x; \
-        GlPrintErrors(__FILE__, __LINE__, #x); \
-    } else
+// Flipbook sprites: animation frames packed into one atlas texture, with the
+// frame rectangles in a uniform buffer, drawn as instanced quads. Each
+// instance carries its own start time, rate and frame range and the vertex
+// shader picks the frame from a time uniform, so once a batch is uploaded,
+// animating any number of sprites costs one glUniform1f and one draw a frame.
+#define FLIPBOOK_MAX_FRAMES     256 // uFrameRects in flipbookVertexShader.glsl: 4 KiB of std140 vec4s
+#define FLIPBOOK_FRAMES_BINDING 0   // uniform buffer binding point
 
-long GetFileSize(FILE* file) {
-    if (fseek(file, 0, SEEK_END) == -1) {
-        perror("fseek");
-        exit(errno);
-    }
+struct FlipbookFrameRect { float u0, v0, u1, v1; }; // v0 is the top edge, as in CreateQuad
+
+struct Flipbook {
+    unsigned int texture;
+    unsigned int frameBuffer; // FlipbookFrameRects (a std140 vec4 array)
+    int frameCount;
+    float fps; // the source's own rate, for instances that want it
+};
 
-    long size = ftell(file);
-    if (size == -1) {
-        perror("ftell");
-        exit(errno);
+struct SpriteInstance {
+    float x, y, w, h; // clip space, from the bottom-left corner
+    float startTime; // seconds, on the clock handed to DrawFlipbookSprites
+    float fps;
+    int firstFrame, frameCount; // within the flipbook's frames
+};
+
+struct SpriteBatch {
+    unsigned int vertexArray;
+    unsigned int instanceBuffer;
+    int count;
+};
+
+// Wraps an atlas texture already uploaded (sprite sheets, or LoadGifFlipbook's).
+void CreateFlipbook(Flipbook& fb, unsigned int texture, span<const FlipbookFrameRect> frames, float fps) {
+    assert(!frames.empty() && frames.size() <= FLIPBOOK_MAX_FRAMES);
+    fb.texture = texture;
+    fb.frameCount = (int)frames.size();
+    fb.fps = fps;
+    // Sized for the whole uFrameRects block: a buffer bound to a uniform
+    // block must be at least as large as the block.
+    fb.frameBuffer = CreateGlBufferEx(nullptr, FLIPBOOK_MAX_FRAMES*sizeof(FlipbookFrameRect), GL_UNIFORM_BUFFER, GL_STATIC_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, frames.size_bytes(), frames.data());
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+// Decodes every frame of the GIF at path into a grid atlas created on the
+// active unit. Frame rectangles are inset by half a texel so filtering never
+// reaches the neighbouring frames. Prints why and returns false on failure.
+bool LoadGifFlipbook(Flipbook& fb, const char* path) {
+    MappedFile file = ReadFile(path);
+    int w, h;
+    stbi_gif_stream* stream = stbi_gif_stream_open(file.data, (int)file.size, &w, &h);
+    if (!stream) {
+        cerr << "LoadGifFlipbook: " << path << ": " << stbi_failure_reason() << "\n";
+        return false;
+    }
+    size_t frameSize = (size_t)w*h*4;
+    vector<unsigned char> pixels;
+    int count = 0, totalDelayMs = 0, result = 1;
+    while (count < FLIPBOOK_MAX_FRAMES) {
+        pixels.resize((count + 1)*frameSize);
+        int delayMs;
+        result = stbi_gif_stream_next(stream, pixels.data() + count*frameSize, 0, &delayMs);
+        if (result <= 0) {
+            break;
+        }
+        totalDelayMs += delayMs < ANIMATED_TEXTURE_MIN_DELAY_MS ? ANIMATED_TEXTURE_DEFAULT_DELAY : delayMs;
+        ++count;
+    }
+    stbi_gif_stream_close(stream);
+    if (result < 0 || count == 0) {
+        cerr << "LoadGifFlipbook: " << path << ": " << (result < 0 ? stbi_failure_reason() : "no frames") << "\n";
+        return false;
     }
 
-    rewind(file);
+    int columns = (int)ceil(sqrt((double)count)), rows = (count + columns - 1)/columns;
+    int maxSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+    if (columns*w > maxSize || rows*h > maxSize) {
+        cerr << "LoadGifFlipbook: " << path << ": " << count << " frames of " << w << "x" << h << " do not fit one texture\n";
+        return false;
+    }
 
-    return size;
+    ImageInfo info = {};
+    info.w = columns*w;
+    info.h = rows*h;
+    info.channels = 4;
+    info.levels = 1;
+    unsigned int texture = CreateGlTexture(info);
+    vector<FlipbookFrameRect> rects(count);
+    for (int i = 0; i < count; ++i) {
+        int x = i % columns*w, y = i/columns*h;
+        glTexSubImage2D(GL_TEXTURE_2D, 0, x, y, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data() + i*frameSize);
+        rects[i] = {(x + 0.5f)/info.w, (y + 0.5f)/info.h, (x + w - 0.5f)/info.w, (y + h - 0.5f)/info.h};
+    }
+    CreateFlipbook(fb, texture, rects, 1000.0f*count/totalDelayMs);
+    return true;
 }
 
-std::string ReadFile(const char* path) {
-    FILE* file = fopen(path, "rb");
-    if (file == nullptr) {
-        perror("fopen");
-        exit(errno);
+// Uploads the instances once; they animate without further uploads.
+void CreateSpriteBatch(SpriteBatch& batch, span<const SpriteInstance> instances) {
+    batch.count = (int)instances.size();
+    batch.vertexArray = CreateGlVertexArray();
+    batch.instanceBuffer = CreateGlBufferEx((void*)instances.data(), instances.size_bytes(), GL_ARRAY_BUFFER, GL_STATIC_DRAW);
+
+    GLsizei stride = sizeof(SpriteInstance);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(SpriteInstance, x));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, stride, (void*)offsetof(SpriteInstance, startTime));
+    glEnableVertexAttribArray(2);
+    glVertexAttribIPointer(2, 2, GL_INT, stride, (void*)offsetof(SpriteInstance, firstFrame));
+    for (unsigned int i = 0; i < 3; ++i) {
+        glVertexAttribDivisor(i, 1);
     }
+    glBindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+// Routes the program's FlipbookFrames block to FLIPBOOK_FRAMES_BINDING.
+unsigned int CreateFlipbookProgram(string_view vertexShader, string_view fragmentShader) {
+    unsigned int program = CreateGlProgram(vertexShader, fragmentShader);
+    glUniformBlockBinding(program, glGetUniformBlockIndex(program, "FlipbookFrames"), FLIPBOOK_FRAMES_BINDING);
+    return program;
+}
+
+// Draws the whole batch in one call, at time seconds. Uses texture unit
+// unit, which is left active.
+void DrawFlipbookSprites(SpriteBatch const& batch, Flipbook const& fb, unsigned int program, unsigned int unit, float time) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+    glBindTexture(GL_TEXTURE_2D, fb.texture);
+    glBindBufferBase(GL_UNIFORM_BUFFER, FLIPBOOK_FRAMES_BINDING, fb.frameBuffer);
+
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "uAtlas"), unit);
+    glUniform1f(glGetUniformLocation(program, "uTime"), time);
+    glBindVertexArray(batch.vertexArray);
+    GL_CHECK(glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, batch.count));
+}
+
+void DestroySpriteBatch(SpriteBatch& batch) {
+    glDeleteVertexArrays(1, &batch.vertexArray);
+    glDeleteBuffers(1, &batch.instanceBuffer);
+    batch = {};
+}
+
+void DestroyFlipbook(Flipbook& fb) {
+    glDeleteTextures(1, &fb.texture);
+    glDeleteBuffers(1, &fb.frameBuffer);
+    fb = {};
+}
+
+// Virtual texturing over a tiled pyramid (see tilePyramid.h). A fixed-size
+// cache texture holds VIRTUAL_TEXTURE_CACHE_TILES^2 tiles from any level, and
+// a page table maps every tile of every level to the cache slot standing in
+// for it: its own when resident, otherwise its nearest resident ancestor's,
+// so a missing tile shows blurry instead of black. Each frame the viewer
+// requests the tiles its view covers at the level the shader will pick; they
+// decode on the pool and, coarsest level first through the UploadScheduler,
+// replace the least recently visible tiles. The single coarsest tile is
+// always resident.
+#define VIRTUAL_TEXTURE_CACHE_TILES 16 // per side: 256 slots, 16 MiB of RGBA8 with 128-pixel tiles
+#define VIRTUAL_TEXTURE_MAX_DECODES 16 // in flight (or queued for upload) at once, nearest the view centre first
+#define VIRTUAL_TEXTURE_MAX_LEVELS  32 // uPageOffsets/uPageCounts in virtualTextureFragmentShader.glsl
+
+enum VirtualTextureTileState {
+    VIRTUAL_TILE_MISSING  = -1,
+    VIRTUAL_TILE_DECODING = -2,
+    VIRTUAL_TILE_BROKEN   = -3, // failed to decode, not requested again
+};
 
-    string fileContent;
-    long fileSize = GetFileSize(file);
-    fileContent.resize(fileSize);
+struct VirtualTextureDecode {
+    int tile;
+    future<unsigned char*> pixels; // ImageAlloc'd tileSize^2 pixels, nullptr on failure
+};
+
+// One level's slice of the page table atlas: level 0 on the left, the
+// coarser levels stacked in a column to its right.
+struct PageTableLevel {
+    int x, y; // in the atlas
+    vector<uint32_t> entries; // RGBA8: cache slot x, y, level of the tile in it, 255
+    int dirtyX0, dirtyY0, dirtyX1, dirtyY1; // not yet uploaded, empty when x0 >= x1
+};
+
+struct VirtualTexture {
+    MappedFile file;
+    TilePyramidHeader header;
+    const TilePyramidLevel* levels;
+    const TilePyramidTile* tiles;
+    int content; // see TileContentSize
+
+    unsigned int cacheTexture;
+    unsigned int pageTableTexture;
+    int pageTableW, pageTableH;
+    vector<PageTableLevel> pageTable;
+
+    vector<int> tileSlots; // per tile: cache slot or a VirtualTextureTileState
+    vector<int> slotTiles; // per slot: tile, or -1 when free
+    vector<uint64_t> slotLastUse; // frame the slot's tile was last in view
+    vector<VirtualTextureDecode> decoding;
+    size_t queued; // decoded tiles waiting in the UploadScheduler
+    uint64_t frame;
+    size_t uploads, evictions;
+};
 
-    size_t readCount = fread(fileContent.data(), 1, fileSize, file);
-    if (readCount != fileSize) {
-        perror("fread");
-        exit(errno);
+int VirtualTileLevel(VirtualTexture const& vt, int tile) {
+    int level = vt.header.levels - 1;
+    while (vt.levels[level].firstTile > (uint64_t)tile) {
+        --level;
     }
+    return level;
+}
+
+// Matches the level virtualTextureFragmentShader.glsl picks from its derivatives.
+int VirtualTextureLevelFor(VirtualTexture const& vt, float texelsPerPixel) {
+    int level = (int)floorf(log2f(texelsPerPixel > 1.0f ? texelsPerPixel : 1.0f));
+    return level < (int)vt.header.levels - 1 ? level : (int)vt.header.levels - 1;
+}
 
-    if (fclose(file) == EOF) {
-        perror("fclose");
-        exit(errno);
+// Points (level, tx, ty) and every descendant without a tile of its own at entry.
+void FillPageTable(VirtualTexture& vt, int level, int tx, int ty, uint32_t entry) {
+    TilePyramidLevel const& info = vt.levels[level];
+    PageTableLevel& pt = vt.pageTable[level];
+    pt.entries[(size_t)ty*info.tilesX + tx] = entry;
+    pt.dirtyX0 = min(pt.dirtyX0, tx);
+    pt.dirtyY0 = min(pt.dirtyY0, ty);
+    pt.dirtyX1 = max(pt.dirtyX1, tx + 1);
+    pt.dirtyY1 = max(pt.dirtyY1, ty + 1);
+    if (level == 0) {
+        return;
     }
 
-    return fileContent;
+    TilePyramidLevel const& finer = vt.levels[level - 1];
+    for (int cy = 2*ty; cy < 2*ty + 2 && cy < (int)finer.tilesY; ++cy) {
+        for (int cx = 2*tx; cx < 2*tx + 2 && cx < (int)finer.tilesX; ++cx) {
+            if (vt.tileSlots[finer.firstTile + (size_t)cy*finer.tilesX + cx] < 0) {
+                FillPageTable(vt, level - 1, cx, cy, entry);
+            }
+        }
+    }
 }
 
-unsigned int CreateGlShader(unsigned int type, string& sourceCode) {
-    unsigned int shader = glCreateShader(type);
-    const char* sourceCodeData = sourceCode.data();
-    glShaderSource(shader, 1, &sourceCodeData, nullptr);
-    glCompileShader(shader);
+// Re-points a tile's subtree after it became resident or was evicted.
+void RefreshPageTable(VirtualTexture& vt, int tile) {
+    int level = VirtualTileLevel(vt, tile);
+    TilePyramidLevel const& info = vt.levels[level];
+    int index = tile - (int)info.firstTile;
+    int tx = index % info.tilesX, ty = index / info.tilesX;
 
-    int result; glGetShaderiv(shader, GL_COMPILE_STATUS, &result);
-    if (!result) {
-        int len; glGetShaderiv(shader, GL_INFO_LOG_LENGTH, &len);
-        char* message = (char*)alloca(len*sizeof(char));
-        glGetShaderInfoLog(shader, len, &len, message);
-        const char* shaderTypeStr = type == GL_VERTEX_SHADER ? "vertex" : (type == GL_FRAGMENT_SHADER ? "fragment" : "unknown");
-        cerr << "ERROR: CompileShader (" << shaderTypeStr << "): " << message << "\n";
-        exit(1);
+    uint32_t entry;
+    if (int slot = vt.tileSlots[tile]; slot >= 0) {
+        entry = (slot % VIRTUAL_TEXTURE_CACHE_TILES) | (slot / VIRTUAL_TEXTURE_CACHE_TILES) << 8 | level << 16 | 0xffu << 24;
+    } else {
+        // The coarsest tile is never evicted, so there is always a parent here.
+        TilePyramidLevel const& coarser = vt.levels[level + 1];
+        entry = vt.pageTable[level + 1].entries[(size_t)(ty/2)*coarser.tilesX + tx/2];
     }
+    FillPageTable(vt, level, tx, ty, entry);
+}
 
-    return shader;
+// Runs on a pool worker; the file mapping outlives every decode.
+unsigned char* DecodeVirtualTile(const unsigned char* data, size_t size, int tileSize, int channels) {
+    int w, h, tileChannels;
+    if (!QoiInfo(data, size, &w, &h, &tileChannels) || w != tileSize || h != tileSize || tileChannels != channels) {
+        return nullptr;
+    }
+    auto pixels = (unsigned char*)ImageAlloc((size_t)tileSize*tileSize*channels);
+    if (pixels && !QoiDecodeInto(data, size, pixels)) {
+        ImageFree(pixels);
+        pixels = nullptr;
+    }
+    return pixels;
 }
 
-unsigned int CreateGlProgram(string& vertexShader, string& fragmentShader) {
-    unsigned int program = glCreateProgram();
-    unsigned int vs = CreateGlShader(GL_VERTEX_SHADER, vertexShader);
-    unsigned int fs = CreateGlShader(GL_FRAGMENT_SHADER, fragmentShader);
+void UploadVirtualTile(VirtualTexture& vt, int slot, const unsigned char* pixels) {
+    int tileSize = vt.header.tileSize;
+    glBindTexture(GL_TEXTURE_2D, vt.cacheTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, (slot % VIRTUAL_TEXTURE_CACHE_TILES)*tileSize, (slot / VIRTUAL_TEXTURE_CACHE_TILES)*tileSize,
+                    tileSize, tileSize, vt.header.channels == 4 ? GL_RGBA : GL_RGB, GL_UNSIGNED_BYTE, pixels);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    ++vt.uploads;
+}
 
-    glAttachShader(program, vs);
-    glAttachShader(program, fs);
-    glLinkProgram(program);
+// Maps the .tiles file, creates the cache and page table textures (on the
+// active unit) and loads the coarsest tile. Prints why and returns false if
+// the file is not a usable pyramid.
+bool OpenVirtualTexture(VirtualTexture& vt, const char* path) {
+    vt = {};
+    vt.file = MapFile(path, MAP_FILE_RANDOM);
+    auto header = (const TilePyramidHeader*)vt.file.data;
+    if (vt.file.size < sizeof(TilePyramidHeader) || header->magic != TILE_PYRAMID_MAGIC || header->version != TILE_PYRAMID_VERSION ||
+        header->levels < 1 || header->levels > VIRTUAL_TEXTURE_MAX_LEVELS || (header->channels != 3 && header->channels != 4) ||
+        TileContentSize(header->tileSize, header->border) < 2 || header->w < 1 || header->h < 1 ||
+        header->w > INT_MAX || header->h > INT_MAX) {
+        cerr << path << ": not a tile pyramid, see tilebuilder\n";
+        return false;
+    }
+    vt.header = *header;
+    vt.content = TileContentSize(header->tileSize, header->border);
+    if (vt.file.size - sizeof(TilePyramidHeader) < header->levels*sizeof(TilePyramidLevel)) {
+        cerr << path << ": truncated tile pyramid\n";
+        return false;
+    }
+    vt.levels = (const TilePyramidLevel*)(header + 1);
+    vt.tiles = (const TilePyramidTile*)(vt.levels + header->levels);
+
+    // Everything below indexes the page table and the tile table with these,
+    // so each level has to be exactly what tilebuilder would have written.
+    uint64_t tileCount = 0;
+    for (uint32_t level = 0; level < header->levels; ++level) {
+        TilePyramidLevel const& l = vt.levels[level];
+        int w = MipDimension(header->w, level), h = MipDimension(header->h, level);
+        if (l.w != (uint32_t)w || l.h != (uint32_t)h || l.firstTile != tileCount ||
+            l.tilesX != (uint32_t)TileCount(w, vt.content) || l.tilesY != (uint32_t)TileCount(h, vt.content)) {
+            cerr << path << ": level " << level << " of the tile pyramid is inconsistent\n";
+            return false;
+        }
+        tileCount += (uint64_t)l.tilesX*l.tilesY;
+    }
+    TilePyramidLevel const& last = vt.levels[header->levels - 1];
+    size_t tableBytes = vt.file.size - sizeof(TilePyramidHeader) - header->levels*sizeof(TilePyramidLevel);
+    if (tileCount > tableBytes/sizeof(TilePyramidTile) || last.tilesX != 1 || last.tilesY != 1) {
+        cerr << path << ": truncated tile pyramid\n";
+        return false;
+    }
+    for (size_t i = 0; i < tileCount; ++i) {
+        if (vt.tiles[i].offset > vt.file.size || vt.tiles[i].size > vt.file.size - vt.tiles[i].offset) {
+            cerr << path << ": tile " << i << " is out of bounds\n";
+            return false;
+        }
+    }
 
-    int result;
-    glGetProgramiv(program, GL_LINK_STATUS, &result);
-    if (!result) {
-        int len;
-        glGetProgramiv(program, GL_INFO_LOG_LENGTH, &len);
-        char* message = (char*)alloca(len * sizeof(char));
-        glGetProgramInfoLog(program, len, &len, message);
-        cerr << "ERROR: LinkProgram: " << message << "\n";
-        exit(1);
+    vt.pageTable.resize(header->levels);
+    vt.pageTableW = vt.levels[0].tilesX;
+    vt.pageTableH = vt.levels[0].tilesY;
+    int columnY = 0;
+    for (uint32_t level = 0; level < header->levels; ++level) {
+        PageTableLevel& pt = vt.pageTable[level];
+        pt.x = level == 0 ? 0 : vt.levels[0].tilesX;
+        pt.y = level == 0 ? 0 : columnY;
+        pt.entries.resize((size_t)vt.levels[level].tilesX*vt.levels[level].tilesY);
+        if (level > 0) {
+            columnY += vt.levels[level].tilesY;
+            vt.pageTableW = max(vt.pageTableW, pt.x + (int)vt.levels[level].tilesX);
+            vt.pageTableH = max(vt.pageTableH, columnY);
+        }
+    }
+    int maxTextureSize = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxTextureSize);
+    int cacheSize = VIRTUAL_TEXTURE_CACHE_TILES*header->tileSize;
+    if (vt.pageTableW > maxTextureSize || vt.pageTableH > maxTextureSize || cacheSize > maxTextureSize) {
+        cerr << path << ": page table (" << vt.pageTableW << "x" << vt.pageTableH << ") or tile cache (" << cacheSize
+             << ") exceeds GL_MAX_TEXTURE_SIZE\n";
+        return false;
     }
 
-    glValidateProgram(program);
+    glGenTextures(1, &vt.cacheTexture);
+    glBindTexture(GL_TEXTURE_2D, vt.cacheTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    AllocateGlTextureStorage(GL_RGBA8, GL_RGBA, cacheSize, cacheSize, 1);
+
+    glGenTextures(1, &vt.pageTableTexture);
+    glBindTexture(GL_TEXTURE_2D, vt.pageTableTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    AllocateGlTextureStorage(GL_RGBA8, GL_RGBA, vt.pageTableW, vt.pageTableH, 1);
+
+    vt.tileSlots.assign(tileCount, VIRTUAL_TILE_MISSING);
+    vt.slotTiles.assign(VIRTUAL_TEXTURE_CACHE_TILES*VIRTUAL_TEXTURE_CACHE_TILES, -1);
+    vt.slotLastUse.assign(vt.slotTiles.size(), 0);
+
+    // The coarsest tile lives in slot 0 for good; every entry falls back to it.
+    int root = (int)tileCount - 1;
+    unsigned char* pixels = DecodeVirtualTile(vt.file.data + vt.tiles[root].offset, vt.tiles[root].size, header->tileSize, header->channels);
+    if (!pixels) {
+        cerr << path << ": cannot decode the coarsest tile\n";
+        return false;
+    }
+    UploadVirtualTile(vt, 0, pixels);
+    ImageFree(pixels);
+    vt.tileSlots[root] = 0;
+    vt.slotTiles[0] = root;
+    for (auto& pt : vt.pageTable) {
+        pt.dirtyX0 = pt.dirtyY0 = INT_MAX;
+        pt.dirtyX1 = pt.dirtyY1 = 0;
+    }
+    RefreshPageTable(vt, root);
+    return true;
+}
 
-    // FIXME: detach shaders too?
-    glDeleteShader(vs);
-    glDeleteShader(fs);
+// Requests the tiles under the level-0 pixel rectangle [x0, x1) x [y0, y1)
+// at the level drawn for texelsPerPixel, and keeps resident ones in the cache.
+void RequestVirtualTextureTiles(VirtualTexture& vt, ThreadPool& pool, float x0, float y0, float x1, float y1, float texelsPerPixel) {
+    // A view needing more tiles than the cache holds is served from a coarser
+    // level (the page table falls back to it) instead of churning decodes.
+    int level = VirtualTextureLevelFor(vt, texelsPerPixel);
+    int tx0, tx1, ty0, ty1;
+    float levelScale;
+    for (;; ++level) {
+        TilePyramidLevel const& info = vt.levels[level];
+        levelScale = 1.0f/(float)(vt.content << level);
+        tx0 = max(0, (int)floorf(x0*levelScale));
+        tx1 = min((int)info.tilesX - 1, (int)floorf(x1*levelScale));
+        ty0 = max(0, (int)floorf(y0*levelScale));
+        ty1 = min((int)info.tilesY - 1, (int)floorf(y1*levelScale));
+        if (level + 1 == (int)vt.header.levels || (size_t)(tx1 - tx0 + 1)*(ty1 - ty0 + 1) < vt.slotTiles.size()) {
+            break;
+        }
+    }
+    TilePyramidLevel const& info = vt.levels[level];
+    float centreX = 0.5f*(x0 + x1)*levelScale, centreY = 0.5f*(y0 + y1)*levelScale;
+
+    vector<pair<float, int>> missing;
+    for (int ty = ty0; ty <= ty1; ++ty) {
+        for (int tx = tx0; tx <= tx1; ++tx) {
+            int tile = (int)info.firstTile + ty*info.tilesX + tx;
+            if (int slot = vt.tileSlots[tile]; slot >= 0) {
+                vt.slotLastUse[slot] = vt.frame;
+            } else if (slot == VIRTUAL_TILE_MISSING) {
+                float dx = tx + 0.5f - centreX, dy = ty + 0.5f - centreY;
+                missing.push_back({dx*dx + dy*dy, tile});
+            }
+        }
+    }
 
-    return program;
+    sort(missing.begin(), missing.end());
+    for (auto [distance, tile] : missing) {
+        if (vt.decoding.size() + vt.queued >= VIRTUAL_TEXTURE_MAX_DECODES) {
+            break;
+        }
+        const unsigned char* data = vt.file.data + vt.tiles[tile].offset;
+        size_t size = vt.tiles[tile].size;
+        int tileSize = vt.header.tileSize, channels = vt.header.channels;
+        vt.tileSlots[tile] = VIRTUAL_TILE_DECODING;
+        vt.decoding.push_back({tile, pool.Submit([=] { return DecodeVirtualTile(data, size, tileSize, channels); })});
+    }
 }
 
-unsigned int CreateGlVertexArray() {
-    unsigned int va;
-    glGenVertexArrays(1, &va);
-    glBindVertexArray(va);
-    return va;
+// Free slot, else the least recently visible one not in view this frame; -1 if all are.
+int AcquireVirtualTextureSlot(VirtualTexture& vt) {
+    int best = -1;
+    for (int slot = 1; slot < (int)vt.slotTiles.size(); ++slot) {
+        if (vt.slotTiles[slot] < 0) {
+            return slot;
+        }
+        if (vt.slotLastUse[slot] < vt.frame && (best < 0 || vt.slotLastUse[slot] < vt.slotLastUse[best])) {
+            best = slot;
+        }
+    }
+    if (best >= 0) {
+        int evicted = vt.slotTiles[best];
+        vt.tileSlots[evicted] = VIRTUAL_TILE_MISSING;
+        vt.slotTiles[best] = -1;
+        RefreshPageTable(vt, evicted);
+        ++vt.evictions;
+    }
+    return best;
 }
 
-unsigned int CreateGlBufferEx(void* data, size_t byteSize, GLenum target, GLenum dynamic) {
-    unsigned int buffer;
-    glGenBuffers(1, &buffer);
-    glBindBuffer(target, buffer);
-    glBufferData(target, byteSize, data, dynamic);
-    return buffer;
+// Moves a decoded tile into the cache, from EndUploadFrame.
+void StoreVirtualTile(VirtualTexture& vt, int tile, unsigned char* pixels) {
+    int slot = AcquireVirtualTextureSlot(vt);
+    if (slot >= 0) {
+        UploadVirtualTile(vt, slot, pixels);
+        vt.tileSlots[tile] = slot;
+        vt.slotTiles[slot] = tile;
+        vt.slotLastUse[slot] = vt.frame;
+        RefreshPageTable(vt, tile);
+    } else {
+        // Everything cached is in view; asked for again next frame.
+        vt.tileSlots[tile] = VIRTUAL_TILE_MISSING;
+    }
+    ImageFree(pixels);
+    --vt.queued;
 }
-#define CreateGlBuffer(data, target, dynamic) CreateGlBufferEx(data, sizeof(data), target, dynamic)
 
-unsigned int GetGlTypeSize(unsigned int glType) {
-    unsigned int glTypeSize = 0;
-    switch (glType) {
-        case GL_FLOAT: glTypeSize = 4; break;
-        default: assert(false && "unknown targetSize");
+// Called once per frame on the GL thread, after RequestVirtualTextureTiles and
+// before EndUploadFrame. Never blocks on a decode; finished ones are queued on
+// scheduler, coarser levels first as they stand in for more of the view.
+void UpdateVirtualTexture(VirtualTexture& vt, UploadScheduler& scheduler) {
+    for (size_t i = 0; i < vt.decoding.size();) {
+        VirtualTextureDecode& decode = vt.decoding[i];
+        if (!IsReady(decode.pixels)) {
+            ++i;
+            continue;
+        }
+
+        int tile = decode.tile;
+        unsigned char* pixels = decode.pixels.get();
+        if (pixels) {
+            ++vt.queued;
+            size_t bytes = (size_t)vt.header.tileSize*vt.header.tileSize*vt.header.channels;
+            ScheduleUpload(scheduler, VirtualTileLevel(vt, tile), bytes, [&vt, tile, pixels] { StoreVirtualTile(vt, tile, pixels); });
+        } else {
+            cerr << "VirtualTexture: tile " << tile << " does not decode\n";
+            vt.tileSlots[tile] = VIRTUAL_TILE_BROKEN;
+        }
+        vt.decoding.erase(vt.decoding.begin() + i);
     }
-    return glTypeSize;
 }
 
-void EnableGlVertexAttribArray(initializer_list<GlVertexAttrib> vertexAttributes) {
-    unsigned int stride = 0;
-    for (auto const& attrib : vertexAttributes) {
-        stride += attrib.count*GetGlTypeSize(attrib.glType);
+// Called once per frame after EndUploadFrame (and before DrawVirtualTexture):
+// sends the page table entries the frame's tile uploads changed.
+void EndVirtualTextureFrame(VirtualTexture& vt) {
+    glBindTexture(GL_TEXTURE_2D, vt.pageTableTexture);
+    for (uint32_t level = 0; level < vt.header.levels; ++level) {
+        PageTableLevel& pt = vt.pageTable[level];
+        if (pt.dirtyX0 >= pt.dirtyX1) {
+            continue;
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, vt.levels[level].tilesX);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, pt.x + pt.dirtyX0, pt.y + pt.dirtyY0, pt.dirtyX1 - pt.dirtyX0, pt.dirtyY1 - pt.dirtyY0,
+                        GL_RGBA, GL_UNSIGNED_BYTE, pt.entries.data() + (size_t)pt.dirtyY0*vt.levels[level].tilesX + pt.dirtyX0);
+        pt.dirtyX0 = pt.dirtyY0 = INT_MAX;
+        pt.dirtyX1 = pt.dirtyY1 = 0;
     }
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    ++vt.frame;
+}
 
-    size_t offset = 0;
-    unsigned int i = 0;
-    for (auto const& attrib : vertexAttributes) {
-        glEnableVertexAttribArray(i);
-        glVertexAttribPointer(i, attrib.count, attrib.glType, GL_FALSE, stride, (void*)offset);
-        offset += attrib.count*GetGlTypeSize(attrib.glType);
-        ++i;
+// Draws the view whose top-left corner is level-0 pixel (originX, originY),
+// texelsPerPixel image pixels per framebuffer pixel, over the whole viewport.
+// Uses texture units cacheUnit and cacheUnit + 1, which are left active.
+void DrawVirtualTexture(VirtualTexture const& vt, unsigned int program, unsigned int cacheUnit, float originX, float originY,
+                        float texelsPerPixel, int viewportW, int viewportH) {
+    glActiveTexture(GL_TEXTURE0 + cacheUnit);
+    glBindTexture(GL_TEXTURE_2D, vt.cacheTexture);
+    glActiveTexture(GL_TEXTURE0 + cacheUnit + 1);
+    glBindTexture(GL_TEXTURE_2D, vt.pageTableTexture);
+
+    int offsets[VIRTUAL_TEXTURE_MAX_LEVELS*2] = {}, counts[VIRTUAL_TEXTURE_MAX_LEVELS*2] = {};
+    for (uint32_t level = 0; level < vt.header.levels; ++level) {
+        offsets[level*2] = vt.pageTable[level].x;
+        offsets[level*2 + 1] = vt.pageTable[level].y;
+        counts[level*2] = vt.levels[level].tilesX;
+        counts[level*2 + 1] = vt.levels[level].tilesY;
     }
 
-    assert(offset == stride);
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "uCache"), cacheUnit);
+    glUniform1i(glGetUniformLocation(program, "uPageTable"), cacheUnit + 1);
+    glUniform2iv(glGetUniformLocation(program, "uPageOffsets"), vt.header.levels, offsets);
+    glUniform2iv(glGetUniformLocation(program, "uPageCounts"), vt.header.levels, counts);
+    glUniform1i(glGetUniformLocation(program, "uLevels"), vt.header.levels);
+    glUniform2f(glGetUniformLocation(program, "uImageSize"), (float)vt.header.w, (float)vt.header.h);
+    glUniform3f(glGetUniformLocation(program, "uTile"), (float)vt.header.tileSize, (float)vt.header.border,
+                (float)(VIRTUAL_TEXTURE_CACHE_TILES*vt.header.tileSize));
+    glUniform2f(glGetUniformLocation(program, "uViewOrigin"), originX, originY);
+    glUniform1f(glGetUniformLocation(program, "uViewScale"), texelsPerPixel);
+    glUniform2f(glGetUniformLocation(program, "uViewport"), (float)viewportW, (float)viewportH);
+    GL_CHECK(glDrawArrays(GL_TRIANGLES, 0, 3));
+}
+
+// Waits for in-flight decodes, which read the file mapping.
+// Call after DestroyUploadScheduler, which hands queued tiles back.
+void DestroyVirtualTexture(VirtualTexture& vt) {
+    for (auto& decode : vt.decoding) {
+        ImageFree(decode.pixels.get());
+    }
+    glDeleteTextures(1, &vt.cacheTexture);
+    glDeleteTextures(1, &vt.pageTableTexture);
+    vt = {};
 }
 
 void DisplayImguiDemo(ImguiDemoState& state) {
@@ -315,10 +2797,51 @@ void DisplayImguiDemo(ImguiDemoState& state) {
     }
 }
 
-int main(void)
+int main(int argc, char** argv)
 {
     GLFWwindow* window;
 
+    // Start decoding right away so it overlaps context setup and shader compilation.
+    // CreateQuad flips v, so images load top row first with no flip pass.
+    SetFlipImagesOnLoad(false);
+    assetPack = OpenAssetPack("assets.pack");
+
+    ThreadPool threadPool;
+    stbi_set_parallel_for(StbParallelFor, &threadPool);
+
+    // Only the headers are needed to create the textures, so the frame loop
+    // starts right away and each texture fills in progressively as its
+    // decodes land, higher priority first. They are registered first, so a
+    // duplicate shares the earlier one's decode and texture.
+    struct StartupTexture {
+        const char* path;
+        int flags;
+        int priority;
+        ProgressiveTexture progressive; // unused by a duplicate
+        unsigned int slot; // set once GL is up
+        int handle; // in textureResidency, pinned until fully uploaded; -1 until then
+        bool duplicate; // of an earlier entry, whose handle it shares
+    };
+    StartupTexture startupTextures[] = {
+        {"logo.jpg", IMAGE_LOAD_MIPS | IMAGE_LOAD_RGBA | IMAGE_LOAD_REDUCE_FORMAT, 1, {}, 0, -1, false},
+        // Drawn at about half its width, so there is no point decoding it at full size.
+        {"img2.jpeg", IMAGE_LOAD_MIPS | IMAGE_LOAD_RGBA | IMAGE_LOAD_JPEG_HALF | IMAGE_LOAD_REDUCE_FORMAT, 0, {}, 0, -1, false},
+    };
+    TextureResidency textureResidency;
+    int startupUploadsLeft = 0;
+    for (auto& startup : startupTextures) {
+        startup.handle = ManageGlTexture(textureResidency, startup.path, startup.flags, MIPMAP_CPU);
+        startup.duplicate = textureResidency.textures[startup.handle].refs > 1;
+        if (startup.duplicate) {
+            continue;
+        }
+        ++startupUploadsLeft;
+        if (!StartProgressiveTexture(startup.progressive, threadPool, startup.path, startup.flags, startup.priority)) {
+            cerr << "ProbeImage: " << startup.path << ": " << stbi_failure_reason() << "\n";
+            exit(1);
+        }
+    }
+
     /* Initialize the library */
     if (!glfwInit())
         return -1;
@@ -398,72 +2921,244 @@ int main(void)
 
     unsigned int indexBuffer = CreateGlBuffer(indices, GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW);
 
-    string vertexShaderSource = ReadFile("vertexShader.glsl");
-    string fragmentShaderSource = ReadFile("fragmentShader.glsl");
+    MappedFile vertexShaderSource = ReadFile("vertexShader.glsl");
+    MappedFile fragmentShaderSource = ReadFile("fragmentShader.glsl");
 
-    unsigned int glProgram = CreateGlProgram(vertexShaderSource, fragmentShaderSource);
+    unsigned int glProgram = CreateGlProgram(vertexShaderSource.Text(), fragmentShaderSource.Text());
     glUseProgram(glProgram);
 
     // int uColorLocation = glGetUniformLocation(glProgram, "uColor");
     // assert(uColorLocation != -1);
 
-    stbi_set_flip_vertically_on_load(1);
     unsigned int textureSlot = 1;
     unsigned int textures[3] = {};
+    int textureBudgetMiB = (int)(textureResidency.budget >> 20);
+
+    for (auto& startup : startupTextures) {
+        startup.slot = textureSlot;
+        if (!startup.duplicate) {
+            CreateProgressiveTexture(startup.progressive);
+            AdoptGlTexture(textureResidency, startup.handle, startup.progressive.texture, startup.progressive.info);
+            textureResidency.textures[startup.handle].pinned = true;
+        }
+        textures[textureSlot] = textureResidency.textures[startup.handle].texture;
+        assert(textures[textureSlot] > 0);
+        glActiveTexture(GL_TEXTURE0 + textureSlot);
+        textureSlot++;
+    }
 
-    Image img = ReadImage("logo.jpg");
-    textures[textureSlot] = LoadGlTexture(img, textureSlot);
-    assert(textures[textureSlot] > 0);
-    FreeImage(img);
-    textureSlot++;
-
-    textureSlot = 2;
-    img = ReadImage("img2.jpeg");
-    textures[textureSlot] = LoadGlTexture(img, textureSlot);
-    assert(textures[textureSlot] > 0);
-    FreeImage(img);
-    textureSlot++;
-
+    // Texture slot n is bound to unit n - 1 (see BindManagedGlTexture below).
+    int textureUnits[2] = {0, 1};
     int uTexturesLocation = glGetUniformLocation(glProgram, "uTextures");
     assert(uTexturesLocation != -1);
-    glUniform1iv(uTexturesLocation, 2, (int*)textures);
+    glUniform1iv(uTexturesLocation, 2, textureUnits);
 
     float scaleX = 1.0;
     float scaleY = 1.0;
     int uMvpLocation = glGetUniformLocation(glProgram, "uMvp");
     assert(uMvpLocation != -1);
 
+    // GPU animation mode: the same quads, uploaded once, with the CPU path's
+    // bob (0.6 - sinDt2) evaluated by animatedVertexShader.glsl instead, plus
+    // an optional field of ambient quads moving the same way.
+    MappedFile animatedVertexShaderSource = ReadFile("animatedVertexShader.glsl");
+    unsigned int animatedProgram = CreateGlProgram(animatedVertexShaderSource.Text(), fragmentShaderSource.Text());
+    glUseProgram(animatedProgram);
+    glUniform1iv(glGetUniformLocation(animatedProgram, "uTextures"), 2, textureUnits);
+    int animatedMvpLocation = glGetUniformLocation(animatedProgram, "uMvp");
+    glUseProgram(glProgram);
+
+    Motion bob = {1.0f, 2.0f, 0.0f, EASING_LINEAR};
+    AnimatedQuad animatedQuads[] = {
+        CreateAnimatedQuad(-0.8, 0.6, 0.2, color1, 0.0f, bob),
+        CreateAnimatedQuad(+0.6, 0.6, 0.2, color2, 1.0f, bob),
+    };
+    AnimatedMesh animatedMesh = {};
+    CreateAnimatedMesh(animatedMesh, animatedQuads);
+    AnimatedMesh ambientMesh = {};
+    TweenedQuads ambientTweened = {}; // the same field, for when GPU animation is off
+    int ambientQuadCount = 0;
+    double ambientCpuMs = 0.0;
+    bool animateOnGpu = false;
+    bool drawTexturedQuads = true;
+
     // glBindVertexArray(0);
     // glBindBuffer(GL_ARRAY_BUFFER, 0);
     // glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
     // glUseProgram(0);
 
+    TextureStreamer textureStreamer = {};
+
+    // main image.tiles pans and zooms over a tiled pyramid (see tilebuilder)
+    // behind the quads; any .gif arguments play in the ImGui window.
+    const char* virtualTexturePath = nullptr;
+    vector<const char*> animationPaths;
+    for (int arg = 1; arg < argc; ++arg) {
+        if (string_view(argv[arg]).ends_with(".gif")) {
+            animationPaths.push_back(argv[arg]);
+        } else {
+            virtualTexturePath = argv[arg];
+        }
+    }
+
+    VirtualTexture virtualTexture = {};
+    unsigned int virtualTextureProgram = 0;
+    float viewZoom = 0.0f; // log2 of image pixels per framebuffer pixel
+    float viewCentreX = 0.5f, viewCentreY = 0.5f;
+    if (virtualTexturePath) {
+        glActiveTexture(GL_TEXTURE0 + textureSlot);
+        if (!OpenVirtualTexture(virtualTexture, virtualTexturePath)) {
+            exit(1);
+        }
+        MappedFile vertexSource = ReadFile("virtualTextureVertexShader.glsl");
+        MappedFile fragmentSource = ReadFile("virtualTextureFragmentShader.glsl");
+        virtualTextureProgram = CreateGlProgram(vertexSource.Text(), fragmentSource.Text());
+
+        int viewportW, viewportH;
+        glfwGetFramebufferSize(window, &viewportW, &viewportH);
+        viewZoom = log2f(max((float)virtualTexture.header.w/viewportW, (float)virtualTexture.header.h/viewportH));
+    }
+
+    vector<AnimatedTexture> animatedTextures(animationPaths.size());
+    for (size_t i = 0; i < animationPaths.size(); ++i) {
+        glActiveTexture(GL_TEXTURE0 + textureSlot);
+        if (!OpenAnimatedTexture(animatedTextures[i], animationPaths[i])) {
+            exit(1);
+        }
+    }
+
+    // The first GIF also plays as two rows of flipbook sprites along the
+    // bottom of the window, each at its own phase and rate.
+    Flipbook flipbook = {};
+    SpriteBatch spriteBatch = {};
+    unsigned int flipbookProgram = 0;
+    if (!animationPaths.empty()) {
+        glActiveTexture(GL_TEXTURE0 + textureSlot);
+        if (!LoadGifFlipbook(flipbook, animationPaths[0])) {
+            exit(1);
+        }
+        MappedFile vertexSource = ReadFile("flipbookVertexShader.glsl");
+        MappedFile fragmentSource = ReadFile("flipbookFragmentShader.glsl");
+        flipbookProgram = CreateFlipbookProgram(vertexSource.Text(), fragmentSource.Text());
+
+        int viewportW, viewportH;
+        glfwGetFramebufferSize(window, &viewportW, &viewportH);
+        AnimatedTexture const& source = animatedTextures[0];
+        float spriteW = 2.0f/16, spriteH = spriteW*viewportW/viewportH*source.h/source.w;
+        vector<SpriteInstance> sprites;
+        for (int i = 0; i < 32; ++i) {
+            sprites.push_back({-1.0f + (i % 16)*spriteW, -1.0f + (i/16)*spriteH, spriteW, spriteH, 0.05f*i,
+                               flipbook.fps*(0.5f + 0.25f*(i % 4)), 0, flipbook.frameCount});
+        }
+        CreateSpriteBatch(spriteBatch, sprites);
+    }
+
+    // Texture uploads that can wait share a per-frame time budget.
+    UploadScheduler uploadScheduler;
+
     float dt = 0.0f;
     while (!glfwWindowShouldClose(window))
     {
+        BeginUploadFrame(uploadScheduler);
+        for (auto& startup : startupTextures) {
+            ProgressiveTexture& progressive = startup.progressive;
+            if (startup.duplicate || progressive.done) {
+                continue;
+            }
+            bool uploaded = PumpProgressiveTexture(progressive, uploadScheduler);
+            // Swapped for a smaller format once the pixels were seen.
+            if (progressive.texture != textures[startup.slot]) {
+                textures[startup.slot] = progressive.texture;
+                AdoptGlTexture(textureResidency, startup.handle, progressive.texture, progressive.info);
+            }
+            if (!uploaded) {
+                continue;
+            }
+            textureResidency.textures[startup.handle].pinned = false;
+
+            // The startup batch is uploaded; hand its decode buffers back to the system.
+            if (--startupUploadsLeft == 0) {
+                TrimImagePool();
+            }
+        }
+        PumpTextureStreams(textureStreamer, threadPool, uploadScheduler);
+        double now = glfwGetTime();
+        for (auto& animated : animatedTextures) {
+            PumpAnimatedTexture(animated, threadPool, uploadScheduler, now);
+        }
+
+        int viewportW, viewportH;
+        glfwGetFramebufferSize(window, &viewportW, &viewportH);
+        float texelsPerPixel = exp2f(viewZoom);
+        float originX = viewCentreX*virtualTexture.header.w - 0.5f*viewportW*texelsPerPixel;
+        float originY = viewCentreY*virtualTexture.header.h - 0.5f*viewportH*texelsPerPixel;
+        if (virtualTextureProgram) {
+            RequestVirtualTextureTiles(virtualTexture, threadPool, originX, originY, originX + viewportW*texelsPerPixel,
+                                       originY + viewportH*texelsPerPixel, texelsPerPixel);
+            UpdateVirtualTexture(virtualTexture, uploadScheduler);
+        }
+        EndUploadFrame(uploadScheduler);
+
         /* Render here */
         glClear(GL_COLOR_BUFFER_BIT);
 
+        if (virtualTextureProgram) {
+            EndVirtualTextureFrame(virtualTexture);
+            glBindVertexArray(va);
+            DrawVirtualTexture(virtualTexture, virtualTextureProgram, textureSlot + 1, originX, originY, texelsPerPixel, viewportW, viewportH);
+            glActiveTexture(GL_TEXTURE0 + textureSlot);
+        }
+
         float sinDt1 = (1.0f + sinf(1*dt)) / 2.0f;
         float sinDt2 = (1.0f + sinf(2*dt)) / 2.0f;
         float sinDt3 = (1.0f + sinf(3*dt)) / 2.0f;
 
-        glBindVertexArray(va);
-        glUseProgram(glProgram);
+        // Unbound textures become eviction candidates (with a small enough
+        // budget) and stream back in when drawn again.
+        if (drawTexturedQuads) {
+            for (auto& startup : startupTextures) {
+                textures[startup.slot] = BindManagedGlTexture(textureResidency, textureStreamer, threadPool, startup.handle, startup.slot - 1);
+            }
+        }
+        glActiveTexture(GL_TEXTURE0 + textureSlot);
         // glUniform4f(uColorLocation, sinDt1, sinDt2, sinDt3, 1.0f);
 
-        vertices[0] = CreateQuad(-0.8, 0.6-sinDt2, 0.2, color1, 0.0f);
-        vertices[1] = CreateQuad(+0.6, 0.6-sinDt2, 0.2, color2, 1.0f);
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
-
         float mvp[16] = {
             1.5f + scaleX, 0.0          , 0.0, 0.0,
             0.0          , 2.0f + scaleY, 0.0, 0.0,
             0.0          , 0.0          , 1.5, 0.0,
             0.0          , 0.0          , 0.0, 2.0,
         };
-        glUniformMatrix4fv(uMvpLocation, 1, 0, &mvp[0]);
-        GL_CHECK(glDrawElements(GL_TRIANGLES, 12, GL_UNSIGNED_INT, nullptr));
+        if (drawTexturedQuads) {
+            if (animateOnGpu) {
+                glUseProgram(animatedProgram);
+                glUniformMatrix4fv(animatedMvpLocation, 1, 0, &mvp[0]);
+                DrawAnimatedMesh(animatedMesh, animatedProgram, dt);
+                if (ambientMesh.indexCount) {
+                    DrawAnimatedMesh(ambientMesh, animatedProgram, dt);
+                }
+            } else {
+                glBindVertexArray(va);
+                glUseProgram(glProgram);
+                vertices[0] = CreateQuad(-0.8, 0.6-sinDt2, 0.2, color1, 0.0f);
+                vertices[1] = CreateQuad(+0.6, 0.6-sinDt2, 0.2, color2, 1.0f);
+                glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+                glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vertices), vertices);
+
+                glUniformMatrix4fv(uMvpLocation, 1, 0, &mvp[0]);
+                GL_CHECK(glDrawElements(GL_TRIANGLES, 12, GL_UNSIGNED_INT, nullptr));
+                if (!ambientTweened.quads.empty()) {
+                    auto start = chrono::steady_clock::now();
+                    UpdateTweenedQuads(ambientTweened, threadPool, dt);
+                    ambientCpuMs = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+                    DrawTweenedQuads(ambientTweened);
+                }
+            }
+        }
+
+        if (flipbookProgram) {
+            DrawFlipbookSprites(spriteBatch, flipbook, flipbookProgram, textureSlot, (float)now);
+        }
 
         // float mvp2[16] = {
         //     1.5f - scaleX, 0.0          , 0.0, 0.0,
@@ -484,6 +3179,49 @@ int main(void)
             ImGui::Begin("Hello, world!");
             ImGui::SliderFloat("scale X", &scaleX, -1.0f, 1.0f);
             ImGui::SliderFloat("scale Y", &scaleY, -1.0f, 1.0f);
+            ImGui::Checkbox("animate on GPU", &animateOnGpu);
+            ImGui::Checkbox("draw textured quads", &drawTexturedQuads);
+            if (ImGui::SliderInt("ambient quads", &ambientQuadCount, 0, 100000)) {
+                DestroyAnimatedMesh(ambientMesh);
+                DestroyTweenedQuads(ambientTweened);
+                if (ambientQuadCount > 0) {
+                    vector<AnimatedQuad> ambient = CreateAmbientQuads(ambientQuadCount);
+                    CreateAnimatedMesh(ambientMesh, ambient);
+                    CreateTweenedQuads(ambientTweened, ambient);
+                }
+            }
+            if (ambientQuadCount > 0 && !animateOnGpu) {
+                ImGui::Text("Ambient quads: %.2f ms to tween, rebuild and upload", ambientCpuMs);
+            }
+            if (ImGui::Button("Reload textures")) {
+                for (auto& startup : startupTextures) {
+                    StreamManagedGlTexture(textureResidency, textureStreamer, threadPool, startup.handle);
+                }
+            }
+            if (ImGui::SliderInt("VRAM budget (MiB)", &textureBudgetMiB, 0, 1024)) {
+                textureResidency.budget = (size_t)textureBudgetMiB << 20;
+            }
+            ImGui::Text("Textures resident: %.1f MiB, %zu evictions, %zu reloads, %zu duplicates shared",
+                        textureResidency.residentBytes/1048576.0, textureResidency.evictions, textureResidency.reloads,
+                        textureResidency.duplicates);
+            ImGui::SliderFloat("upload budget (ms)", &uploadScheduler.budgetMs, 0.0f, 8.0f);
+            ImGui::Text("Uploads: %.1f KiB in %.2f ms, %.0f MiB/s, %zu queued", uploadScheduler.lastFrameBytes/1024.0,
+                        uploadScheduler.lastFrameMs, uploadScheduler.bytesPerMs*1000.0/1048576.0, uploadScheduler.jobs.size());
+            if (virtualTextureProgram) {
+                ImGui::SliderFloat("zoom (log2)", &viewZoom, -4.0f, (float)virtualTexture.header.levels);
+                ImGui::SliderFloat("centre X", &viewCentreX, 0.0f, 1.0f);
+                ImGui::SliderFloat("centre Y", &viewCentreY, 0.0f, 1.0f);
+                ImGui::Text("Tiles: %zu uploads, %zu evictions, %zu decoding, %zu queued", virtualTexture.uploads,
+                            virtualTexture.evictions, virtualTexture.decoding.size(), virtualTexture.queued);
+            }
+            for (auto& animated : animatedTextures) {
+                ImGui::Image((ImTextureID)(intptr_t)animated.texture, ImVec2((float)animated.w, (float)animated.h));
+                ImGui::Text("%s: %zu frames shown, %zu late", animated.path.c_str(), animated.uploads, animated.lateFrames);
+            }
+            if (flipbookProgram) {
+                ImGui::Text("Sprites: %d instances of %d frames at %.1f fps, one draw", spriteBatch.count,
+                            flipbook.frameCount, flipbook.fps);
+            }
             ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / io.Framerate, io.Framerate);
             ImGui::End();
         }
@@ -491,6 +3229,7 @@ int main(void)
         // Rendering
         ImGui::Render();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+        EndTextureResidencyFrame(textureResidency);
 
         /* Swap front and back buffers */
         glfwSwapBuffers(window);
@@ -504,7 +3243,25 @@ int main(void)
     ImGui_ImplGlfw_Shutdown();
     ImGui::DestroyContext();
 
-    glDeleteTextures(sizeof(textures)/sizeof(textures[0]), textures);
+    DestroyUploadScheduler(uploadScheduler);
+    for (auto& animated : animatedTextures) {
+        DestroyAnimatedTexture(animated);
+    }
+    if (flipbookProgram) {
+        DestroySpriteBatch(spriteBatch);
+        DestroyFlipbook(flipbook);
+        glDeleteProgram(flipbookProgram);
+    }
+    DestroyTextureStreamer(textureStreamer);
+    DestroyTextureResidency(textureResidency);
+    if (virtualTextureProgram) {
+        DestroyVirtualTexture(virtualTexture);
+        glDeleteProgram(virtualTextureProgram);
+    }
+    DestroyAnimatedMesh(animatedMesh);
+    DestroyAnimatedMesh(ambientMesh);
+    DestroyTweenedQuads(ambientTweened);
+    glDeleteProgram(animatedProgram);
     glDeleteProgram(glProgram);
 
     glfwTerminate();
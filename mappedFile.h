@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <string_view>
+#include <utility>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Read-only view of a file's bytes. When mapBase is set the view owns an mmap
+// and unmaps it on destruction; otherwise it borrows memory owned elsewhere
+// (e.g. an asset pack mapping) and the destructor does nothing.
+struct MappedFile {
+    const unsigned char* data = nullptr;
+    size_t size = 0;
+    void* mapBase = nullptr;
+    size_t mapSize = 0;
+
+    MappedFile() = default;
+    MappedFile(const unsigned char* data, size_t size) : data(data), size(size) {}
+    MappedFile(MappedFile const&) = delete;
+    MappedFile& operator=(MappedFile const&) = delete;
+    MappedFile(MappedFile&& other) { *this = std::move(other); }
+    MappedFile& operator=(MappedFile&& other) {
+        if (this != &other) {
+            Unmap();
+            data = std::exchange(other.data, nullptr);
+            size = std::exchange(other.size, 0);
+            mapBase = std::exchange(other.mapBase, nullptr);
+            mapSize = std::exchange(other.mapSize, 0);
+        }
+        return *this;
+    }
+    ~MappedFile() { Unmap(); }
+
+    void Unmap() {
+        if (mapBase) {
+            munmap(mapBase, mapSize);
+        }
+        data = nullptr;
+        size = 0;
+        mapBase = nullptr;
+        mapSize = 0;
+    }
+
+    explicit operator bool() const { return data != nullptr; }
+    std::span<const unsigned char> Bytes() const { return {data, size}; }
+    std::string_view Text() const { return {(const char*)data, size}; }
+};
+
+enum MapFileFlags {
+    MAP_FILE_DEFAULT    = 0,
+    MAP_FILE_POPULATE   = 1 << 0, // prefault the whole file (small files read start to end)
+    MAP_FILE_RANDOM     = 1 << 1, // random access (asset packs, tile files)
+    MAP_FILE_OPTIONAL   = 1 << 2, // missing file returns an empty MappedFile instead of exiting
+};
+
+// Empty files map to a valid, zero-sized view, since mmap rejects a length of 0.
+MappedFile MapFile(const char* path, int flags = MAP_FILE_POPULATE) {
+    MappedFile result;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if ((flags & MAP_FILE_OPTIONAL) && errno == ENOENT) {
+            return result;
+        }
+        fprintf(stderr, "open %s: ", path);
+        perror("");
+        exit(errno);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        perror("fstat");
+        exit(errno);
+    }
+
+    if (st.st_size > 0) {
+        int mmapFlags = MAP_PRIVATE;
+        if (flags & MAP_FILE_POPULATE) {
+            mmapFlags |= MAP_POPULATE;
+        }
+
+        void* base = mmap(nullptr, st.st_size, PROT_READ, mmapFlags, fd, 0);
+        if (base == MAP_FAILED) {
+            perror("mmap");
+            exit(errno);
+        }
+        // madvise advice values are not flags, so sequential + willneed take two calls.
+        if (flags & MAP_FILE_RANDOM) {
+            madvise(base, st.st_size, MADV_RANDOM);
+        } else {
+            madvise(base, st.st_size, MADV_SEQUENTIAL);
+            if (!(flags & MAP_FILE_POPULATE)) {
+                madvise(base, st.st_size, MADV_WILLNEED);
+            }
+        }
+
+        result.data = (const unsigned char*)base;
+        result.size = st.st_size;
+        result.mapBase = base;
+        result.mapSize = st.st_size;
+    } else {
+        static const unsigned char empty[1] = {};
+        result.data = empty;
+    }
+
+    if (close(fd) == -1) {
+        perror("close");
+        exit(errno);
+    }
+
+    return result;
+}
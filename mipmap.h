@@ -0,0 +1,119 @@
+#pragma once
+
+#include <cstddef>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// CPU mip chain generation. A chain stores every level back to back, largest
+// first, each level tightly packed (no row padding), down to 1x1. Each level
+// is a 2x2 box filter of the previous one; odd trailing rows/columns are
+// dropped except when the source is 1 pixel wide/tall, matching what GL
+// expects for non-power-of-two chains (floor sizes).
+
+int MipLevelCount(int w, int h) {
+    int levels = 1;
+    while (w > 1 || h > 1) {
+        w = w > 1 ? w/2 : 1;
+        h = h > 1 ? h/2 : 1;
+        ++levels;
+    }
+    return levels;
+}
+
+int MipDimension(int size, int level) {
+    size >>= level;
+    return size > 0 ? size : 1;
+}
+
+size_t MipLevelSize(int w, int h, int channels, int level) {
+    return (size_t)MipDimension(w, level)*MipDimension(h, level)*channels;
+}
+
+size_t MipLevelOffset(int w, int h, int channels, int level) {
+    size_t offset = 0;
+    for (int i = 0; i < level; ++i) {
+        offset += MipLevelSize(w, h, channels, i);
+    }
+    return offset;
+}
+
+size_t MipChainSize(int w, int h, int channels, int levels) {
+    return MipLevelOffset(w, h, channels, levels);
+}
+
+// Averages the 2x2 block under each destination pixel of one row.
+void DownsampleRow(const unsigned char* row0, const unsigned char* row1, int srcW,
+                   unsigned char* dst, int dstW, int channels) {
+    int x = 0;
+
+    if (srcW >= 2) {
+#if defined(__SSE2__)
+        // Even and odd source pixels are split apart and widened to 16 bits so
+        // both rows and both pixels of each pair can be summed lane-wise.
+        const __m128i two = _mm_set1_epi16(2);
+        if (channels == 4) {
+            const __m128i zero = _mm_setzero_si128();
+            for (; x + 4 <= dstW; x += 4) {
+                // [p0 p1 p2 p3] [p4 p5 p6 p7] -> even [p0 p2 p4 p6] / odd [p1 p3 p5 p7]
+                __m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(row0 + x*8)), _MM_SHUFFLE(3, 1, 2, 0));
+                __m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(row0 + x*8 + 16)), _MM_SHUFFLE(3, 1, 2, 0));
+                __m128i c = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(row1 + x*8)), _MM_SHUFFLE(3, 1, 2, 0));
+                __m128i d = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)(row1 + x*8 + 16)), _MM_SHUFFLE(3, 1, 2, 0));
+                __m128i even0 = _mm_unpacklo_epi64(a, b), odd0 = _mm_unpackhi_epi64(a, b);
+                __m128i even1 = _mm_unpacklo_epi64(c, d), odd1 = _mm_unpackhi_epi64(c, d);
+
+                __m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(even0, zero), _mm_unpacklo_epi8(odd0, zero)),
+                                           _mm_add_epi16(_mm_unpacklo_epi8(even1, zero), _mm_unpacklo_epi8(odd1, zero)));
+                __m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(even0, zero), _mm_unpackhi_epi8(odd0, zero)),
+                                           _mm_add_epi16(_mm_unpackhi_epi8(even1, zero), _mm_unpackhi_epi8(odd1, zero)));
+                lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+                hi = _mm_srli_epi16(_mm_add_epi16(hi, two), 2);
+                _mm_storeu_si128((__m128i*)(dst + x*4), _mm_packus_epi16(lo, hi));
+            }
+        } else if (channels == 1) {
+            const __m128i lowByte = _mm_set1_epi16(0x00ff);
+            for (; x + 8 <= dstW; x += 8) {
+                __m128i a = _mm_loadu_si128((const __m128i*)(row0 + x*2));
+                __m128i b = _mm_loadu_si128((const __m128i*)(row1 + x*2));
+                __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_and_si128(a, lowByte), _mm_srli_epi16(a, 8)),
+                                            _mm_add_epi16(_mm_and_si128(b, lowByte), _mm_srli_epi16(b, 8)));
+                sum = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+                _mm_storel_epi64((__m128i*)(dst + x), _mm_packus_epi16(sum, sum));
+            }
+        }
+#endif
+    }
+
+    for (; x < dstW; ++x) {
+        int x0 = 2*x < srcW ? 2*x : srcW - 1;
+        int x1 = 2*x + 1 < srcW ? 2*x + 1 : srcW - 1;
+        for (int c = 0; c < channels; ++c) {
+            int sum = row0[x0*channels + c] + row0[x1*channels + c] + row1[x0*channels + c] + row1[x1*channels + c];
+            dst[x*channels + c] = (unsigned char)((sum + 2) >> 2);
+        }
+    }
+}
+
+void DownsampleLevel(const unsigned char* src, int srcW, int srcH, unsigned char* dst, int channels) {
+    int dstW = srcW > 1 ? srcW/2 : 1;
+    int dstH = srcH > 1 ? srcH/2 : 1;
+    size_t srcStride = (size_t)srcW*channels;
+    for (int y = 0; y < dstH; ++y) {
+        const unsigned char* row0 = src + (size_t)(2*y < srcH ? 2*y : srcH - 1)*srcStride;
+        const unsigned char* row1 = src + (size_t)(2*y + 1 < srcH ? 2*y + 1 : srcH - 1)*srcStride;
+        DownsampleRow(row0, row1, srcW, dst + (size_t)y*dstW*channels, dstW, channels);
+    }
+}
+
+// chain holds level 0 on entry and must have room for MipChainSize(levels).
+void GenerateMipChain(unsigned char* chain, int w, int h, int channels, int levels) {
+    unsigned char* src = chain;
+    for (int level = 1; level < levels; ++level) {
+        unsigned char* dst = src + MipLevelSize(w, h, channels, level - 1);
+        DownsampleLevel(src, MipDimension(w, level - 1), MipDimension(h, level - 1), dst, channels);
+        src = dst;
+    }
+}
@@ -0,0 +1,148 @@
+// Builds an asset pack (see assetPack.h) from a list of files.
+//
+//   packer [-d] [-f] out.pack file...
+//
+//   -d  store images pre-decoded (8-bit, native channel count)
+//   -f  flip pre-decoded images vertically, matching SetFlipImagesOnLoad(true)
+
+#define STBI_FAILURE_USERMSG
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "assetPack.h"
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+#include <vector>
+using namespace std;
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct PackInput {
+    string name;
+    MappedFile file;
+    unsigned char* pixels; // set when the image was decoded, owned by stb_image
+    AssetPackEntry entry;
+};
+
+void WriteBytes(FILE* out, const void* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, out) != size) {
+        perror("fwrite");
+        exit(errno);
+    }
+}
+
+void WritePadding(FILE* out, uint64_t from, uint64_t to) {
+    static const unsigned char zeros[ASSET_PACK_ALIGNMENT] = {};
+    WriteBytes(out, zeros, to - from);
+}
+
+int main(int argc, char** argv) {
+    bool decodeImages = false;
+    bool flipImages = false;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        if (strcmp(argv[arg], "-d") == 0) {
+            decodeImages = true;
+        } else if (strcmp(argv[arg], "-f") == 0) {
+            flipImages = true;
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[arg]);
+            return 1;
+        }
+    }
+    if (argc - arg < 2) {
+        fprintf(stderr, "usage: %s [-d] [-f] out.pack file...\n", argv[0]);
+        return 1;
+    }
+
+    const char* outPath = argv[arg++];
+    stbi_set_flip_vertically_on_load(flipImages);
+
+    vector<PackInput> inputs;
+    for (; arg < argc; ++arg) {
+        PackInput input = {};
+        input.name = argv[arg];
+        input.file = MapFile(argv[arg]);
+        input.entry.nameHash = HashString(input.name);
+        input.entry.kind = ASSET_RAW;
+        input.entry.size = input.file.size;
+
+        int w, h, channels;
+        if (decodeImages && stbi_info_from_memory(input.file.data, (int)input.file.size, &w, &h, &channels)) {
+            input.pixels = stbi_load_from_memory(input.file.data, (int)input.file.size, &w, &h, &channels, 0);
+            if (!input.pixels) {
+                fprintf(stderr, "%s: %s\n", argv[arg], stbi_failure_reason());
+                return 1;
+            }
+            input.entry.kind = ASSET_IMAGE;
+            input.entry.flags = flipImages ? (uint32_t)ASSET_FLIPPED_VERTICALLY : 0;
+            input.entry.w = w;
+            input.entry.h = h;
+            input.entry.channels = channels;
+            input.entry.size = (uint64_t)w*h*channels;
+        }
+
+        inputs.push_back(std::move(input));
+    }
+
+    sort(inputs.begin(), inputs.end(), [](PackInput const& a, PackInput const& b) {
+        return a.entry.nameHash < b.entry.nameHash;
+    });
+
+    AssetPackHeader header = {};
+    header.magic = ASSET_PACK_MAGIC;
+    header.version = ASSET_PACK_VERSION;
+    header.entryCount = (uint32_t)inputs.size();
+    header.tocOffset = sizeof(AssetPackHeader);
+    header.namesOffset = header.tocOffset + inputs.size()*sizeof(AssetPackEntry);
+
+    for (auto& input : inputs) {
+        input.entry.nameOffset = header.namesSize;
+        input.entry.nameLength = (uint32_t)input.name.size();
+        header.namesSize += input.entry.nameLength;
+    }
+
+    uint64_t offset = header.namesOffset + header.namesSize;
+    for (auto& input : inputs) {
+        offset = AlignAssetOffset(offset);
+        input.entry.offset = offset;
+        offset += input.entry.size;
+    }
+
+    FILE* out = fopen(outPath, "wb");
+    if (out == nullptr) {
+        perror("fopen");
+        exit(errno);
+    }
+
+    WriteBytes(out, &header, sizeof(header));
+    for (auto const& input : inputs) {
+        WriteBytes(out, &input.entry, sizeof(input.entry));
+    }
+    for (auto const& input : inputs) {
+        WriteBytes(out, input.name.data(), input.name.size());
+    }
+
+    offset = header.namesOffset + header.namesSize;
+    for (auto const& input : inputs) {
+        WritePadding(out, offset, input.entry.offset);
+        WriteBytes(out, input.pixels ? input.pixels : input.file.data, input.entry.size);
+        offset = input.entry.offset + input.entry.size;
+        printf("%-32s %10llu bytes%s\n", input.name.c_str(), (unsigned long long)input.entry.size,
+               input.entry.kind == ASSET_IMAGE ? " (decoded)" : "");
+        stbi_image_free(input.pixels);
+    }
+
+    if (fclose(out) == EOF) {
+        perror("fclose");
+        exit(errno);
+    }
+
+    return 0;
+}
@@ -0,0 +1,494 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define PIXEL_OPS_X86 1
+#endif
+
+// Load-time pixel transforms, fused into a single sweep over the image:
+// every destination row is produced from one source row (optionally read
+// bottom-up), expanded and premultiplied while it is still in registers.
+// Row kernels are picked once at runtime: AVX2, SSSE3, or scalar.
+
+enum PixelTransformFlags {
+    PIXEL_FLIP_ROWS   = 1 << 0, // destination row y comes from source row h-1-y
+    PIXEL_EXPAND_RGBA = 1 << 1, // 3-channel source becomes 4-channel with opaque alpha
+    PIXEL_PREMULTIPLY = 1 << 2, // rgb = rgb*a/255 on 4-channel output (in the image's own encoding)
+};
+
+// Exact round(x/255) for x in [0, 255*255].
+int Div255(int x) {
+    x += 128;
+    return (x + (x >> 8)) >> 8;
+}
+
+// Handles the whole row, or the tail the vector kernels leave over.
+void TransformRowScalar(const unsigned char* src, unsigned char* dst, int count, int srcChannels, int flags) {
+    bool expand = (flags & PIXEL_EXPAND_RGBA) && srcChannels == 3;
+    int dstChannels = expand ? 4 : srcChannels;
+    bool premultiply = (flags & PIXEL_PREMULTIPLY) && dstChannels == 4;
+
+    for (int x = 0; x < count; ++x) {
+        const unsigned char* s = src + (size_t)x*srcChannels;
+        unsigned char* d = dst + (size_t)x*dstChannels;
+        unsigned char r = s[0], g = dstChannels > 1 ? s[1] : 0, b = dstChannels > 2 ? s[2] : 0;
+        unsigned char a = expand ? 255 : (dstChannels == 4 ? s[3] : 0);
+        if (premultiply) {
+            r = (unsigned char)Div255(r*a);
+            g = (unsigned char)Div255(g*a);
+            b = (unsigned char)Div255(b*a);
+        }
+        d[0] = r;
+        if (dstChannels > 1) d[1] = g;
+        if (dstChannels > 2) d[2] = b;
+        if (dstChannels > 3) d[3] = a;
+    }
+}
+
+#if PIXEL_OPS_X86
+
+// Four RGBA pixels in 16-bit lanes (two per register): rgb *= a / 255.
+__attribute__((target("ssse3")))
+__m128i PremultiplySsse3(__m128i rgba) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i alphaMask = _mm_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0);
+    const __m128i c128 = _mm_set1_epi16(128);
+    __m128i lo = _mm_unpacklo_epi8(rgba, zero);
+    __m128i hi = _mm_unpackhi_epi8(rgba, zero);
+    __m128i alphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, 0xff), 0xff);
+    __m128i alphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, 0xff), 0xff);
+    // Multiply alpha by 255 instead of itself so the alpha lanes come back unchanged.
+    alphaLo = _mm_or_si128(_mm_andnot_si128(alphaMask, alphaLo), _mm_and_si128(alphaMask, _mm_set1_epi16(255)));
+    alphaHi = _mm_or_si128(_mm_andnot_si128(alphaMask, alphaHi), _mm_and_si128(alphaMask, _mm_set1_epi16(255)));
+    lo = _mm_add_epi16(_mm_mullo_epi16(lo, alphaLo), c128);
+    hi = _mm_add_epi16(_mm_mullo_epi16(hi, alphaHi), c128);
+    lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+    hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+    return _mm_packus_epi16(lo, hi);
+}
+
+__attribute__((target("ssse3")))
+void TransformRowSsse3(const unsigned char* src, unsigned char* dst, int count, int srcChannels, int flags) {
+    bool expand = (flags & PIXEL_EXPAND_RGBA) && srcChannels == 3;
+    int dstChannels = expand ? 4 : srcChannels;
+    bool premultiply = (flags & PIXEL_PREMULTIPLY) && dstChannels == 4;
+    int x = 0;
+
+    if (expand) {
+        const __m128i shuffle = _mm_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m128i opaque = _mm_set1_epi32((int)0xff000000);
+        // Reads 16 bytes for 12, so stop while a full load stays inside the row.
+        for (; x + 6 <= count; x += 4) {
+            __m128i rgba = _mm_or_si128(_mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(src + x*3)), shuffle), opaque);
+            _mm_storeu_si128((__m128i*)(dst + x*4), rgba);
+        }
+    } else if (premultiply) {
+        for (; x + 4 <= count; x += 4) {
+            __m128i rgba = _mm_loadu_si128((const __m128i*)(src + x*4));
+            _mm_storeu_si128((__m128i*)(dst + x*4), PremultiplySsse3(rgba));
+        }
+    } else {
+        memcpy(dst, src, (size_t)count*srcChannels);
+        return;
+    }
+
+    TransformRowScalar(src + (size_t)x*srcChannels, dst + (size_t)x*dstChannels, count - x, srcChannels, flags);
+}
+
+__attribute__((target("avx2")))
+__m256i PremultiplyAvx2(__m256i rgba) {
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i alphaShuffle = _mm256_setr_epi8(6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15,
+                                                  6, 7, 6, 7, 6, 7, 6, 7, 14, 15, 14, 15, 14, 15, 14, 15);
+    const __m256i alphaMask = _mm256_set_epi16(-1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0, -1, 0, 0, 0);
+    const __m256i c255 = _mm256_set1_epi16(255);
+    const __m256i c128 = _mm256_set1_epi16(128);
+    __m256i lo = _mm256_unpacklo_epi8(rgba, zero);
+    __m256i hi = _mm256_unpackhi_epi8(rgba, zero);
+    __m256i alphaLo = _mm256_blendv_epi8(_mm256_shuffle_epi8(lo, alphaShuffle), c255, alphaMask);
+    __m256i alphaHi = _mm256_blendv_epi8(_mm256_shuffle_epi8(hi, alphaShuffle), c255, alphaMask);
+    lo = _mm256_add_epi16(_mm256_mullo_epi16(lo, alphaLo), c128);
+    hi = _mm256_add_epi16(_mm256_mullo_epi16(hi, alphaHi), c128);
+    lo = _mm256_srli_epi16(_mm256_add_epi16(lo, _mm256_srli_epi16(lo, 8)), 8);
+    hi = _mm256_srli_epi16(_mm256_add_epi16(hi, _mm256_srli_epi16(hi, 8)), 8);
+    return _mm256_packus_epi16(lo, hi);
+}
+
+__attribute__((target("avx2")))
+void TransformRowAvx2(const unsigned char* src, unsigned char* dst, int count, int srcChannels, int flags) {
+    bool expand = (flags & PIXEL_EXPAND_RGBA) && srcChannels == 3;
+    int dstChannels = expand ? 4 : srcChannels;
+    bool premultiply = (flags & PIXEL_PREMULTIPLY) && dstChannels == 4;
+    int x = 0;
+
+    if (expand) {
+        // vpshufb works within 128-bit lanes, so each lane gets its own 4 source pixels.
+        const __m256i shuffle = _mm256_setr_epi8(0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+                                                 0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+        const __m256i opaque = _mm256_set1_epi32((int)0xff000000);
+        // Expanded pixels are opaque, so premultiplying them is the identity.
+        for (; x + 10 <= count; x += 8) {
+            __m128i lo = _mm_loadu_si128((const __m128i*)(src + x*3));
+            __m128i hi = _mm_loadu_si128((const __m128i*)(src + x*3 + 12));
+            __m256i rgb = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+            __m256i rgba = _mm256_or_si256(_mm256_shuffle_epi8(rgb, shuffle), opaque);
+            _mm256_storeu_si256((__m256i*)(dst + x*4), rgba);
+        }
+    } else if (premultiply) {
+        for (; x + 8 <= count; x += 8) {
+            __m256i rgba = _mm256_loadu_si256((const __m256i*)(src + x*4));
+            _mm256_storeu_si256((__m256i*)(dst + x*4), PremultiplyAvx2(rgba));
+        }
+    } else {
+        memcpy(dst, src, (size_t)count*srcChannels);
+        return;
+    }
+
+    TransformRowScalar(src + (size_t)x*srcChannels, dst + (size_t)x*dstChannels, count - x, srcChannels, flags);
+}
+
+#endif
+
+typedef void (*TransformRowFn)(const unsigned char* src, unsigned char* dst, int count, int srcChannels, int flags);
+
+TransformRowFn SelectTransformRow() {
+#if PIXEL_OPS_X86
+    if (__builtin_cpu_supports("avx2")) {
+        return TransformRowAvx2;
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return TransformRowSsse3;
+    }
+#endif
+    return TransformRowScalar;
+}
+
+int TransformedChannels(int srcChannels, int flags) {
+    return ((flags & PIXEL_EXPAND_RGBA) && srcChannels == 3) ? 4 : srcChannels;
+}
+
+// src and dst may alias only when PIXEL_FLIP_ROWS and PIXEL_EXPAND_RGBA are both off.
+void TransformPixels(const unsigned char* src, int w, int h, int srcChannels, unsigned char* dst, int flags) {
+    static const TransformRowFn transformRow = SelectTransformRow();
+
+    // Expanding an image with nothing else to do still goes through the kernel;
+    // a plain flip is a row copy.
+    bool rowWork = (flags & (PIXEL_EXPAND_RGBA | PIXEL_PREMULTIPLY)) && (srcChannels == 3 || srcChannels == 4);
+    int dstChannels = rowWork ? TransformedChannels(srcChannels, flags) : srcChannels;
+    size_t srcStride = (size_t)w*srcChannels;
+    size_t dstStride = (size_t)w*dstChannels;
+
+    for (int y = 0; y < h; ++y) {
+        const unsigned char* srcRow = src + (size_t)((flags & PIXEL_FLIP_ROWS) ? h - 1 - y : y)*srcStride;
+        unsigned char* dstRow = dst + (size_t)y*dstStride;
+        if (rowWork) {
+            transformRow(srcRow, dstRow, w, srcChannels, flags);
+        } else if (srcRow != dstRow) {
+            memcpy(dstRow, srcRow, srcStride);
+        }
+    }
+}
+
+// Load-time content analysis for format reduction: which channels an image
+// actually uses. Both checks stop at the first pixel that disproves them.
+enum PixelContentFlags {
+    PIXEL_OPAQUE = 1 << 0, // every alpha is 255 (always set without an alpha channel)
+    PIXEL_GRAY   = 1 << 1, // r == g == b everywhere (always set for 1 and 2 channels)
+};
+
+int AnalyzePixelsScalar(const unsigned char* p, size_t count, int channels, int content) {
+    for (size_t i = 0; i < count && content; ++i, p += channels) {
+        if ((content & PIXEL_GRAY) && channels >= 3 && (p[0] != p[1] || p[1] != p[2])) {
+            content &= ~PIXEL_GRAY;
+        }
+        if ((content & PIXEL_OPAQUE) && (channels == 2 || channels == 4) && p[channels - 1] != 255) {
+            content &= ~PIXEL_OPAQUE;
+        }
+    }
+    return content;
+}
+
+#if defined(__SSE2__)
+
+// Blocks of 4 KiB between early-out checks keep the common "it is colour"
+// case to a few cache lines.
+#define PIXEL_ANALYZE_BLOCK 4096
+
+// Differences are OR-ed into accumulators and only tested once per block.
+int AnalyzePixelsSse2(const unsigned char* p, size_t count, int channels, int content) {
+    size_t size = count*channels;
+    size_t i = 0;
+    const __m128i ones = _mm_set1_epi8(-1);
+
+    if (channels == 4 || channels == 2) {
+        // Alpha is the top byte of every pixel; gray compares r-g and g-b via a one-byte shift.
+        const __m128i alphaMask = channels == 4 ? _mm_set1_epi32((int)0xff000000) : _mm_set1_epi16((short)0xff00);
+        const __m128i grayMask = _mm_set1_epi32(0x0000ffff);
+        while (content && i + 16 <= size) {
+            size_t end = i + PIXEL_ANALYZE_BLOCK < size ? i + PIXEL_ANALYZE_BLOCK : size;
+            __m128i alpha = ones, diff = _mm_setzero_si128();
+            for (; i + 16 <= end; i += 16) {
+                __m128i v = _mm_loadu_si128((const __m128i*)(p + i));
+                alpha = _mm_and_si128(alpha, v);
+                if (channels == 4) {
+                    diff = _mm_or_si128(diff, _mm_and_si128(_mm_xor_si128(v, _mm_srli_epi32(v, 8)), grayMask));
+                }
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_or_si128(alpha, _mm_andnot_si128(alphaMask, ones)), ones)) != 0xffff) {
+                content &= ~PIXEL_OPAQUE;
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff) {
+                content &= ~PIXEL_GRAY;
+            }
+        }
+    } else if (channels == 3) {
+        // Each byte is compared with the next: in 48 bytes (16 pixels) the
+        // pairs that matter (r-g, g-b) repeat with period 3 across the three loads.
+        const __m128i masks[3] = {
+            _mm_setr_epi8(-1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1),
+            _mm_setr_epi8(-1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1),
+            _mm_setr_epi8(0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0, -1, -1, 0),
+        };
+        // The shifted load reads one byte ahead, so stop a block short of the end.
+        while (content && i + 49 <= size) {
+            size_t end = i + PIXEL_ANALYZE_BLOCK*3/4 < size ? i + PIXEL_ANALYZE_BLOCK*3/4 : size;
+            __m128i diff = _mm_setzero_si128();
+            for (; i + 49 <= end; i += 48) {
+                for (int k = 0; k < 3; ++k) {
+                    __m128i a = _mm_loadu_si128((const __m128i*)(p + i + 16*k));
+                    __m128i b = _mm_loadu_si128((const __m128i*)(p + i + 16*k + 1));
+                    diff = _mm_or_si128(diff, _mm_and_si128(_mm_xor_si128(a, b), masks[k]));
+                }
+            }
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xffff) {
+                content &= ~PIXEL_GRAY;
+            }
+        }
+    }
+
+    return AnalyzePixelsScalar(p + i, (size - i)/channels, channels, content);
+}
+
+#endif
+
+int AnalyzePixels(const unsigned char* p, size_t count, int channels) {
+    int content = PIXEL_OPAQUE | PIXEL_GRAY;
+    if (channels == 1) {
+        return content;
+    }
+#if defined(__SSE2__)
+    return AnalyzePixelsSse2(p, count, channels, content);
+#else
+    return AnalyzePixelsScalar(p, count, channels, content);
+#endif
+}
+
+// Channel count format reduction settles on, given AnalyzePixels' verdict.
+// Gray RGB(A) narrows to 1 or 2 channels unless it is sRGB (core GL has no
+// single-channel sRGB format); gray + alpha sources have no sRGB format to
+// lose. Opaque alpha goes unless keepRgba. Never more than channels, as
+// ReducePixels narrows in place.
+int ReducedChannelCount(int channels, int content, bool srgb, bool keepRgba) {
+    bool gray = channels <= 2 || ((content & PIXEL_GRAY) && !srgb);
+    bool hasAlpha = channels == 2 || channels == 4;
+    bool dropAlpha = hasAlpha && (content & PIXEL_OPAQUE) && (gray || !keepRgba);
+    if (gray) {
+        return hasAlpha && !dropAlpha ? 2 : 1;
+    }
+    return dropAlpha ? 3 : channels;
+}
+
+// Drops channels in one forward pass: 4 -> 3 (alpha), 4 -> 2 (gray, alpha),
+// 4/3/2 -> 1 (gray). dst may alias src, since no pixel moves forward.
+void ReducePixels(const unsigned char* src, size_t count, int srcChannels, unsigned char* dst, int dstChannels) {
+    int alpha = srcChannels - 1;
+    for (size_t i = 0; i < count; ++i, src += srcChannels, dst += dstChannels) {
+        unsigned char r = src[0], g = src[1], b = srcChannels > 2 ? src[2] : 0, a = src[alpha];
+        dst[0] = r;
+        if (dstChannels == 2) {
+            dst[1] = a;
+        } else if (dstChannels == 3) {
+            dst[1] = g;
+            dst[2] = b;
+        }
+    }
+}
+
+// High-precision pixels (16-bit PNG, Radiance .hdr) are kept at 16 bits per
+// sample rather than widened to 32-bit float: as half floats, or packed as
+// RGB10_A2 when every sample survives the trip through 10 bits (2 for alpha).
+// Conversions run on the loading thread, 8 samples a step with F16C when the
+// CPU has it; the scalar path rounds the same way (to nearest even).
+
+// Bit-exact with _mm_cvtps_ph(x, _MM_FROUND_TO_NEAREST_INT), NaN payloads aside.
+uint16_t FloatToHalf(float f) {
+    const uint32_t infinity = 255u << 23, halfOverflow = (127u + 16) << 23;
+    const uint32_t denormMagic = ((127u - 15) + (23 - 10) + 1) << 23;
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = x & 0x80000000u;
+    x ^= sign;
+
+    uint16_t h;
+    if (x >= halfOverflow) {
+        h = x > infinity ? 0x7e00 : 0x7c00;
+    } else if (x < (113u << 23)) {
+        // Below the smallest normal half: let the float adder round the mantissa.
+        float v, magic;
+        memcpy(&v, &x, sizeof(v));
+        memcpy(&magic, &denormMagic, sizeof(magic));
+        v += magic;
+        memcpy(&x, &v, sizeof(x));
+        h = (uint16_t)(x - denormMagic);
+    } else {
+        uint32_t odd = (x >> 13) & 1;
+        x += ((uint32_t)(15 - 127) << 23) + 0xfff + odd;
+        h = (uint16_t)(x >> 13);
+    }
+    return h | (uint16_t)(sign >> 16);
+}
+
+void FloatsToHalvesScalar(const float* src, uint16_t* dst, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = FloatToHalf(src[i]);
+    }
+}
+
+// 16-bit unorm samples to halves of v/65535. dst may alias src.
+void Unorm16ToHalvesScalar(const uint16_t* src, uint16_t* dst, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        dst[i] = FloatToHalf(src[i]*(1.0f/65535));
+    }
+}
+
+#if PIXEL_OPS_X86
+
+__attribute__((target("avx,f16c")))
+void FloatsToHalvesF16c(const float* src, uint16_t* dst, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i h = _mm256_cvtps_ph(_mm256_loadu_ps(src + i), _MM_FROUND_TO_NEAREST_INT);
+        _mm_storeu_si128((__m128i*)(dst + i), h);
+    }
+    FloatsToHalvesScalar(src + i, dst + i, count - i);
+}
+
+__attribute__((target("avx,f16c")))
+void Unorm16ToHalvesF16c(const uint16_t* src, uint16_t* dst, size_t count) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128 scale = _mm_set1_ps(1.0f/65535);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128 lo = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpacklo_epi16(v, zero)), scale);
+        __m128 hi = _mm_mul_ps(_mm_cvtepi32_ps(_mm_unpackhi_epi16(v, zero)), scale);
+        __m128i h = _mm_unpacklo_epi64(_mm_cvtps_ph(lo, _MM_FROUND_TO_NEAREST_INT), _mm_cvtps_ph(hi, _MM_FROUND_TO_NEAREST_INT));
+        _mm_storeu_si128((__m128i*)(dst + i), h);
+    }
+    Unorm16ToHalvesScalar(src + i, dst + i, count - i);
+}
+
+#endif
+
+void FloatsToHalves(const float* src, uint16_t* dst, size_t count) {
+#if PIXEL_OPS_X86
+    static const bool f16c = __builtin_cpu_supports("f16c");
+    if (f16c) {
+        return FloatsToHalvesF16c(src, dst, count);
+    }
+#endif
+    FloatsToHalvesScalar(src, dst, count);
+}
+
+void Unorm16ToHalves(const uint16_t* src, uint16_t* dst, size_t count) {
+#if PIXEL_OPS_X86
+    static const bool f16c = __builtin_cpu_supports("f16c");
+    if (f16c) {
+        return Unorm16ToHalvesF16c(src, dst, count);
+    }
+#endif
+    Unorm16ToHalvesScalar(src, dst, count);
+}
+
+// Whether a 16-bit sample holds an n-bit value, scaled up either exactly
+// (v*65535/max, rounded) or by bit replication as most encoders do.
+bool IsWidenedUnorm(uint32_t v, int bits) {
+    uint32_t max = (1u << bits) - 1;
+    uint32_t narrow = (v*max + 32767)/65535;
+    uint32_t replicated = narrow << (16 - bits);
+    for (int shift = bits; shift < 16; shift += bits) {
+        replicated |= narrow << (16 - bits) >> shift;
+    }
+    return v == (narrow*65535 + max/2)/max || v == replicated;
+}
+
+// RGB(A) 16-bit samples that RGB10_A2 holds without loss (opaque alpha
+// always does). Stops at the first sample that does not fit.
+bool FitsRgb10A2(const uint16_t* p, size_t count, int channels) {
+    for (size_t i = 0; i < count; ++i, p += channels) {
+        if (!IsWidenedUnorm(p[0], 10) || !IsWidenedUnorm(p[1], 10) || !IsWidenedUnorm(p[2], 10) ||
+            (channels == 4 && !IsWidenedUnorm(p[3], 2))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Packs RGB(A) 16-bit samples as GL_UNSIGNED_INT_2_10_10_10_REV (red in the
+// low bits), rows in reverse order when flip is set. Without flip dst may
+// alias src, since no pixel moves forward.
+void PackRgb10A2(const uint16_t* src, int w, int h, int channels, uint32_t* dst, bool flip) {
+    for (int y = 0; y < h; ++y) {
+        const uint16_t* s = src + (size_t)(flip ? h - 1 - y : y)*w*channels;
+        uint32_t* d = dst + (size_t)y*w;
+        for (int x = 0; x < w; ++x, s += channels) {
+            uint32_t r = (s[0]*1023u + 32767)/65535, g = (s[1]*1023u + 32767)/65535, b = (s[2]*1023u + 32767)/65535;
+            uint32_t a = channels == 4 ? (s[3]*3u + 32767)/65535 : 3;
+            d[x] = r | g << 10 | b << 20 | a << 30;
+        }
+    }
+}
+
+// PIXEL_PREMULTIPLY for 4-channel high-precision pixels, before they are narrowed.
+void PremultiplyFloats(float* p, size_t count) {
+    for (size_t i = 0; i < count; ++i, p += 4) {
+        p[0] *= p[3];
+        p[1] *= p[3];
+        p[2] *= p[3];
+    }
+}
+
+void PremultiplyUnorm16(uint16_t* p, size_t count) {
+    for (size_t i = 0; i < count; ++i, p += 4) {
+        for (int c = 0; c < 3; ++c) {
+            p[c] = (uint16_t)((p[c]*(uint32_t)p[3] + 32767)/65535);
+        }
+    }
+}
+
+// Flip and RGBA expansion for 16-bit samples (halves or unorm), with `one`
+// as the added alpha. Same aliasing rule as TransformPixels.
+void TransformPixels16(const uint16_t* src, int w, int h, int srcChannels, uint16_t* dst, int flags, uint16_t one) {
+    bool expand = (flags & PIXEL_EXPAND_RGBA) && srcChannels == 3;
+    int dstChannels = expand ? 4 : srcChannels;
+    for (int y = 0; y < h; ++y) {
+        const uint16_t* s = src + (size_t)((flags & PIXEL_FLIP_ROWS) ? h - 1 - y : y)*w*srcChannels;
+        uint16_t* d = dst + (size_t)y*w*dstChannels;
+        if (!expand) {
+            if (s != d) {
+                memcpy(d, s, (size_t)w*srcChannels*sizeof(uint16_t));
+            }
+            continue;
+        }
+        for (int x = 0; x < w; ++x, s += 3, d += 4) {
+            d[0] = s[0];
+            d[1] = s[1];
+            d[2] = s[2];
+            d[3] = one;
+        }
+    }
+}
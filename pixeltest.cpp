@@ -0,0 +1,75 @@
+// Checks format reduction (pixelOps.h): the channel count it settles on never
+// exceeds the source's, and reducing in place gives the expected texels.
+// Build with -fsanitize=address to catch a reduction that writes past the image.
+//
+//   pixeltest
+
+#include "pixelOps.h"
+
+#include <vector>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int failures = 0;
+
+void Check(bool ok, const char* what) {
+    if (!ok) {
+        fprintf(stderr, "FAILED: %s\n", what);
+        ++failures;
+    }
+}
+
+// Reduces a gray + alpha, fully opaque image in place, the way
+// ReduceImageFormat does for an sRGB load without IMAGE_LOAD_RGBA.
+void CheckOpaqueGrayAlphaSrgb() {
+    const size_t count = 1000;
+    unsigned char* pixels = (unsigned char*)malloc(count*2);
+    for (size_t i = 0; i < count; ++i) {
+        pixels[i*2] = (unsigned char)i;
+        pixels[i*2 + 1] = 255;
+    }
+
+    int content = AnalyzePixels(pixels, count, 2);
+    Check(content == (PIXEL_GRAY | PIXEL_OPAQUE), "opaque gray + alpha analysis");
+    int channels = ReducedChannelCount(2, content, true, false);
+    Check(channels == 1, "opaque gray + alpha sRGB reduces to 1 channel");
+
+    ReducePixels(pixels, count, 2, pixels, channels);
+    bool same = true;
+    for (size_t i = 0; i < count; ++i) {
+        same = same && pixels[i] == (unsigned char)i;
+    }
+    Check(same, "opaque gray + alpha sRGB texels");
+    free(pixels);
+}
+
+int main() {
+    for (int channels = 1; channels <= 4; ++channels) {
+        for (int content = 0; content <= (PIXEL_GRAY | PIXEL_OPAQUE); ++content) {
+            for (int srgb = 0; srgb < 2; ++srgb) {
+                for (int keepRgba = 0; keepRgba < 2; ++keepRgba) {
+                    int reduced = ReducedChannelCount(channels, content, srgb, keepRgba);
+                    if (reduced < 1 || reduced > channels) {
+                        fprintf(stderr, "FAILED: %d channels (content %d, srgb %d, rgba %d) reduce to %d\n",
+                                channels, content, srgb, keepRgba, reduced);
+                        ++failures;
+                    }
+                }
+            }
+        }
+    }
+    Check(ReducedChannelCount(4, PIXEL_GRAY | PIXEL_OPAQUE, true, false) == 3, "opaque gray sRGB RGBA keeps colour");
+    Check(ReducedChannelCount(4, PIXEL_GRAY, false, true) == 2, "translucent gray RGBA becomes gray + alpha");
+    Check(ReducedChannelCount(2, PIXEL_GRAY, true, false) == 2, "translucent gray + alpha sRGB stays");
+    CheckOpaqueGrayAlphaSrgb();
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("pixeltest: all checks passed\n");
+    return 0;
+}
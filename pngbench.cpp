@@ -0,0 +1,96 @@
+// Times stb_image's PNG decoder with and without the fast inflate/unfilter
+// paths (see stbi__fast_png in stb_image.h) and checks both agree.
+//
+//   pngbench [-n iterations] file.png...
+
+#define STBI_FAILURE_USERMSG
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "mappedFile.h"
+
+#include <chrono>
+#include <vector>
+using namespace std;
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+template <class F>
+double TimeMilliseconds(int iterations, F&& f) {
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()/iterations;
+}
+
+unsigned char* DecodePng(MappedFile const& file, bool fast, int& w, int& h, int& channels) {
+    stbi__fast_png = fast;
+    return stbi_load_from_memory(file.data, (int)file.size, &w, &h, &channels, 0);
+}
+
+int main(int argc, char** argv) {
+    int iterations = 10;
+
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+        iterations = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (arg >= argc || iterations < 1) {
+        fprintf(stderr, "usage: %s [-n iterations] file.png...\n", argv[0]);
+        return 1;
+    }
+
+    double stockTotal = 0, fastTotal = 0;
+    size_t pixelBytesTotal = 0;
+    bool allIdentical = true;
+
+    for (; arg < argc; ++arg) {
+        const char* path = argv[arg];
+        MappedFile file = MapFile(path);
+        if (!stbi_info_from_memory(file.data, (int)file.size, nullptr, nullptr, nullptr)) {
+            fprintf(stderr, "%s: %s\n", path, stbi_failure_reason());
+            continue;
+        }
+
+        int w, h, channels;
+        unsigned char* stock = DecodePng(file, false, w, h, channels);
+        unsigned char* fast = DecodePng(file, true, w, h, channels);
+        if (!stock || !fast) {
+            fprintf(stderr, "%s: %s\n", path, stbi_failure_reason());
+            stbi_image_free(stock);
+            stbi_image_free(fast);
+            continue;
+        }
+        size_t pixelBytes = (size_t)w*h*channels;
+        bool identical = memcmp(stock, fast, pixelBytes) == 0;
+        stbi_image_free(stock);
+        stbi_image_free(fast);
+
+        double stockMs = TimeMilliseconds(iterations, [&] {
+            int x, y, n;
+            stbi_image_free(DecodePng(file, false, x, y, n));
+        });
+        double fastMs = TimeMilliseconds(iterations, [&] {
+            int x, y, n;
+            stbi_image_free(DecodePng(file, true, x, y, n));
+        });
+
+        printf("%s: %dx%dx%d, stock %.3f ms, fast %.3f ms (%.2fx), %.0f MB/s%s\n", path, w, h, channels, stockMs, fastMs,
+               stockMs/fastMs, pixelBytes/(fastMs*1000.0), identical ? "" : " MISMATCH");
+
+        stockTotal += stockMs;
+        fastTotal += fastMs;
+        pixelBytesTotal += pixelBytes;
+        allIdentical = allIdentical && identical;
+    }
+
+    if (fastTotal > 0) {
+        printf("total: stock %.3f ms, fast %.3f ms (%.2fx), %.0f MB/s\n", stockTotal, fastTotal, stockTotal/fastTotal,
+               pixelBytesTotal/(fastTotal*1000.0));
+    }
+    return allIdentical ? 0 : 1;
+}
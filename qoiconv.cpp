@@ -0,0 +1,94 @@
+// Converts an image into the QOI format (see qoi.h).
+//
+//   qoiconv [-b] in.png out.qoi
+//
+//   -b  also time decoding the source with stb_image against decoding the .qoi
+
+#define STBI_FAILURE_USERMSG
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "mappedFile.h"
+#include "qoi.h"
+
+#include <chrono>
+#include <vector>
+using namespace std;
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+template <class F>
+double TimeMilliseconds(int iterations, F&& f) {
+    auto start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; ++i) {
+        f();
+    }
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count()/iterations;
+}
+
+int main(int argc, char** argv) {
+    bool benchmark = false;
+
+    int arg = 1;
+    if (arg < argc && strcmp(argv[arg], "-b") == 0) {
+        benchmark = true;
+        ++arg;
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: %s [-b] in.png out.qoi\n", argv[0]);
+        return 1;
+    }
+
+    const char* inPath = argv[arg];
+    const char* outPath = argv[arg + 1];
+
+    MappedFile source = MapFile(inPath);
+    int w, h, channels;
+    unsigned char* pixels = stbi_load_from_memory(source.data, (int)source.size, &w, &h, &channels, 0);
+    if (!pixels) {
+        fprintf(stderr, "%s: %s\n", inPath, stbi_failure_reason());
+        return 1;
+    }
+
+    // QOI only stores RGB and RGBA.
+    if (channels < 3) {
+        stbi_image_free(pixels);
+        channels = channels == 2 ? 4 : 3;
+        pixels = stbi_load_from_memory(source.data, (int)source.size, &w, &h, nullptr, channels);
+    }
+
+    vector<unsigned char> encoded = QoiEncode(pixels, w, h, channels);
+
+    FILE* out = fopen(outPath, "wb");
+    if (out == nullptr) {
+        perror("fopen");
+        exit(errno);
+    }
+    if (fwrite(encoded.data(), 1, encoded.size(), out) != encoded.size()) {
+        perror("fwrite");
+        exit(errno);
+    }
+    if (fclose(out) == EOF) {
+        perror("fclose");
+        exit(errno);
+    }
+
+    printf("%s: %dx%dx%d, %zu -> %zu bytes\n", outPath, w, h, channels, source.size, encoded.size());
+
+    if (benchmark) {
+        vector<unsigned char> decoded((size_t)w*h*channels);
+        double stbMs = TimeMilliseconds(20, [&] {
+            int x, y, n;
+            stbi_image_free(stbi_load_from_memory(source.data, (int)source.size, &x, &y, &n, 0));
+        });
+        double qoiMs = TimeMilliseconds(20, [&] { QoiDecodeInto(encoded.data(), encoded.size(), decoded.data()); });
+        bool identical = memcmp(decoded.data(), pixels, decoded.size()) == 0;
+        printf("decode: stb_image %.3f ms, qoi %.3f ms (%.1fx)%s\n", stbMs, qoiMs, stbMs/qoiMs, identical ? "" : " MISMATCH");
+    }
+
+    stbi_image_free(pixels);
+    return 0;
+}
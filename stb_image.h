@@ -431,8 +431,31 @@ STBIDEF stbi_uc *stbi_load_from_file  (FILE *f, int *x, int *y, int *channels_in
 
 #ifndef STBI_NO_GIF
 STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int **delays, int *x, int *y, int *z, int *comp, int req_comp);
+
+// animated GIF one frame at a time, for playback: a stream holds the 4-channel
+// canvas plus a snapshot of it from before the last frame was drawn (for
+// "restore previous" disposal) instead of every frame at once. buffer must
+// outlive the stream; a stream may move between threads but is used by one
+// at a time
+typedef struct stbi_gif_stream stbi_gif_stream;
+STBIDEF stbi_gif_stream *stbi_gif_stream_open(stbi_uc const *buffer, int len, int *x, int *y);
+// composes the next frame into output (x*y*4 bytes, rows bottom-up if flip)
+// and returns 1 with its delay in milliseconds; 0 past the last frame
+// (rewind to loop), -1 on a corrupt frame
+STBIDEF int  stbi_gif_stream_next  (stbi_gif_stream *g, stbi_uc *output, int flip, int *delay_ms);
+STBIDEF void stbi_gif_stream_rewind(stbi_gif_stream *g);
+STBIDEF void stbi_gif_stream_close (stbi_gif_stream *g);
 #endif
 
+// as stbi_load_from_memory, but the pixels end up in output (output_size
+// bytes, at least x*y*channels) instead of a fresh allocation: pass a mapped
+// upload buffer to skip the copy. JPEG, non-paletted PNG and format
+// conversions decode straight into it; other formats decode as usual and
+// are copied in. returns output, or NULL on failure (including output being
+// too small); never free the result. thread-safe only with thread-locals
+STBIDEF stbi_uc *stbi_load_from_memory_into(stbi_uc const *buffer, int len, int *x, int *y, int *channels_in_file, int desired_channels,
+                                            stbi_uc *output, size_t output_size);
+
 #ifdef STBI_WINDOWS_UTF8
 STBIDEF int stbi_convert_wchar_to_utf8(char *buffer, size_t bufferlen, const wchar_t* input);
 #endif
@@ -524,6 +547,21 @@ STBIDEF void stbi_set_unpremultiply_on_load_thread(int flag_true_if_should_unpre
 STBIDEF void stbi_convert_iphone_png_to_rgb_thread(int flag_true_if_should_convert);
 STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_flip);
 
+// decode JPEGs at 1/2, 1/4 or 1/8 size (scale_shift 1, 2, 3; 0 is full size)
+// using reduced IDCTs; the output is ceil(w >> shift) x ceil(h >> shift).
+// other formats ignore it, and stbi_info still reports the full size
+STBIDEF void stbi_set_jpeg_scale_on_load(int scale_shift);
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int scale_shift);
+
+// lets large JPEGs decode on several threads: parallel_for must call
+// task(task_data, i) for every i in [0, count) and return once all calls have
+// finished. baseline images loaded from memory that use restart intervals are
+// entropy-decoded and IDCT'd one group of intervals per task, and colour
+// conversion runs in row bands; anything else decodes serially as before.
+// pass NULL to go back to single-threaded decoding
+typedef void stbi_parallel_for(void *user, void (*task)(void *task_data, int index), void *task_data, int count);
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *parallel_for, void *user);
+
 // ZLIB client - used by PNG, available for other purposes
 
 STBIDEF char *stbi_zlib_decode_malloc_guesssize(const char *buffer, int len, int initial_size, int *outlen);
@@ -1066,6 +1104,50 @@ static void *stbi__malloc_mad4(int a, int b, int c, int d, int add)
 }
 #endif
 
+// stbi_load_from_memory_into: the first allocation of a final result that
+// fits goes to the caller's buffer instead; freeing it just hands it back.
+// decoders allocate results with stbi__malloc_output* and release anything
+// that may be one with stbi__free_output
+#ifndef STBI_THREAD_LOCAL
+static stbi_uc *stbi__output_buffer;
+static size_t stbi__output_size;
+static int stbi__output_taken;
+#else
+static STBI_THREAD_LOCAL stbi_uc *stbi__output_buffer;
+static STBI_THREAD_LOCAL size_t stbi__output_size;
+static STBI_THREAD_LOCAL int stbi__output_taken;
+#endif
+
+// add is slack some decoders write past the image; the caller's buffer has
+// none, so check stbi__is_output_buffer before relying on it
+static void *stbi__malloc_output(size_t size, size_t add)
+{
+   if (stbi__output_buffer && !stbi__output_taken && size <= stbi__output_size) {
+      stbi__output_taken = 1;
+      return stbi__output_buffer;
+   }
+   return stbi__malloc(size + add);
+}
+
+static int stbi__is_output_buffer(void *p)
+{
+   return p != NULL && p == stbi__output_buffer;
+}
+
+static void stbi__free_output(void *p)
+{
+   if (stbi__is_output_buffer(p))
+      stbi__output_taken = 0;
+   else
+      STBI_FREE(p);
+}
+
+static void *stbi__malloc_output_mad3(int a, int b, int c, int add)
+{
+   if (!stbi__mad3sizes_valid(a, b, c, add)) return NULL;
+   return stbi__malloc_output((size_t) a*b*c, add);
+}
+
 // returns 1 if the sum of two signed ints is valid (between -2^31 and 2^31-1 inclusive), 0 on overflow.
 static int stbi__addints_valid(int a, int b)
 {
@@ -1134,6 +1216,52 @@ STBIDEF void stbi_set_flip_vertically_on_load_thread(int flag_true_if_should_fli
                                          : stbi__vertically_flip_on_load_global)
 #endif // STBI_THREAD_LOCAL
 
+static int stbi__jpeg_scale_on_load_global = 0;
+
+STBIDEF void stbi_set_jpeg_scale_on_load(int scale_shift)
+{
+   stbi__jpeg_scale_on_load_global = scale_shift < 0 ? 0 : scale_shift > 3 ? 3 : scale_shift;
+}
+
+#ifndef STBI_THREAD_LOCAL
+#define stbi__jpeg_scale_on_load  stbi__jpeg_scale_on_load_global
+#else
+static STBI_THREAD_LOCAL int stbi__jpeg_scale_on_load_local, stbi__jpeg_scale_on_load_set;
+
+STBIDEF void stbi_set_jpeg_scale_on_load_thread(int scale_shift)
+{
+   stbi__jpeg_scale_on_load_local = scale_shift < 0 ? 0 : scale_shift > 3 ? 3 : scale_shift;
+   stbi__jpeg_scale_on_load_set = 1;
+}
+
+#define stbi__jpeg_scale_on_load  (stbi__jpeg_scale_on_load_set       \
+                                    ? stbi__jpeg_scale_on_load_local  \
+                                    : stbi__jpeg_scale_on_load_global)
+#endif // STBI_THREAD_LOCAL
+
+static stbi_parallel_for *stbi__parallel_for = NULL;
+static void *stbi__parallel_for_user = NULL;
+
+// a failure flag any task of a parallel decode may set while the others poll it
+#ifdef __cplusplus
+#include <atomic>
+typedef std::atomic<bool> stbi__atomic_flag;
+#else
+#include <stdatomic.h>
+typedef atomic_bool stbi__atomic_flag;
+#endif
+
+STBIDEF void stbi_set_parallel_for(stbi_parallel_for *parallel_for, void *user)
+{
+   stbi__parallel_for = parallel_for;
+   stbi__parallel_for_user = user;
+}
+
+// smaller images aren't worth the per-task setup
+#ifndef STBI_PARALLEL_MIN_PIXELS
+#define STBI_PARALLEL_MIN_PIXELS  (1 << 20)
+#endif
+
 static void *stbi__load_main(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri, int bpc)
 {
    memset(ri, 0, sizeof(*ri)); // make sure it's initialized if we add new fields
@@ -1193,13 +1321,13 @@ static stbi_uc *stbi__convert_16_to_8(stbi__uint16 *orig, int w, int h, int chan
    int img_len = w * h * channels;
    stbi_uc *reduced;
 
-   reduced = (stbi_uc *) stbi__malloc(img_len);
+   reduced = (stbi_uc *) stbi__malloc_output(img_len, 0);
    if (reduced == NULL) return stbi__errpuc("outofmem", "Out of memory");
 
    for (i = 0; i < img_len; ++i)
       reduced[i] = (stbi_uc)((orig[i] >> 8) & 0xFF); // top half of each byte is sufficient approx of 16->8 bit scaling
 
-   STBI_FREE(orig);
+   stbi__free_output(orig);
    return reduced;
 }
 
@@ -1433,6 +1561,38 @@ STBIDEF stbi_uc *stbi_load_from_memory(stbi_uc const *buffer, int len, int *x, i
    return stbi__load_and_postprocess_8bit(&s,x,y,comp,req_comp);
 }
 
+STBIDEF stbi_uc *stbi_load_from_memory_into(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp,
+                                            stbi_uc *output, size_t output_size)
+{
+   stbi__context s;
+   stbi_uc *result;
+   size_t size;
+   int w, h, n;
+   stbi__start_mem(&s,buffer,len);
+   stbi__output_buffer = output;
+   stbi__output_size = output_size;
+   stbi__output_taken = 0;
+   result = stbi__load_and_postprocess_8bit(&s,&w,&h,&n,req_comp);
+   stbi__output_buffer = NULL;
+   stbi__output_size = 0;
+   if (!result) return NULL;
+
+   if (x) *x = w;
+   if (y) *y = h;
+   if (comp) *comp = n;
+   if (result == output) return output;
+
+   // the decoder (or a conversion) used its own buffer
+   size = (size_t) w * h * (req_comp ? req_comp : n);
+   if (size > output_size) {
+      STBI_FREE(result);
+      return stbi__errpuc("too small", "Output buffer too small");
+   }
+   memcpy(output, result, size);
+   STBI_FREE(result);
+   return output;
+}
+
 STBIDEF stbi_uc *stbi_load_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
 {
    stbi__context s;
@@ -1760,9 +1920,9 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
    if (req_comp == img_n) return data;
    STBI_ASSERT(req_comp >= 1 && req_comp <= 4);
 
-   good = (unsigned char *) stbi__malloc_mad3(req_comp, x, y, 0);
+   good = (unsigned char *) stbi__malloc_output_mad3(req_comp, x, y, 0);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free_output(data);
       return stbi__errpuc("outofmem", "Out of memory");
    }
 
@@ -1787,12 +1947,12 @@ static unsigned char *stbi__convert_format(unsigned char *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                    } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); stbi__free_output(data); stbi__free_output(good); return stbi__errpuc("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free_output(data);
    return good;
 }
 #endif
@@ -1819,7 +1979,7 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
 
    good = (stbi__uint16 *) stbi__malloc(req_comp * x * y * 2);
    if (good == NULL) {
-      STBI_FREE(data);
+      stbi__free_output(data);
       return (stbi__uint16 *) stbi__errpuc("outofmem", "Out of memory");
    }
 
@@ -1844,12 +2004,12 @@ static stbi__uint16 *stbi__convert_format16(stbi__uint16 *data, int img_n, int r
          STBI__CASE(4,1) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]);                   } break;
          STBI__CASE(4,2) { dest[0]=stbi__compute_y_16(src[0],src[1],src[2]); dest[1] = src[3]; } break;
          STBI__CASE(4,3) { dest[0]=src[0];dest[1]=src[1];dest[2]=src[2];                       } break;
-         default: STBI_ASSERT(0); STBI_FREE(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
+         default: STBI_ASSERT(0); stbi__free_output(data); STBI_FREE(good); return (stbi__uint16*) stbi__errpuc("unsupported", "Unsupported format conversion");
       }
       #undef STBI__CASE
    }
 
-   STBI_FREE(data);
+   stbi__free_output(data);
    return good;
 }
 #endif
@@ -1994,6 +2154,9 @@ typedef struct
    int scan_n, order[4];
    int restart_interval, todo;
 
+   int scale_shift; // decoding at 1/(1 << scale_shift) size
+   int block_size;  // output pixels per block side, 8 >> scale_shift
+
 // kernels
    void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
    void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
@@ -2523,6 +2686,59 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
    }
 }
 
+// reduced IDCTs for decoding at 1/2, 1/4 and 1/8 scale: evaluate the 8-point
+// basis at the centre of each 2x2, 4x4 or 8x8 group of pixels, which only
+// needs the low 4x4, 2x2 or 1x1 coefficients (same idea as libjpeg's jidctred.c).
+// the 4-point version has the usual even/odd butterfly; at 2 points both
+// basis functions reduce to cos(pi/4)/2 and at 1 point only the DC is left
+#define STBI__IDCT_4(s0,s1,s2,s3) \
+   int e0 = ((s0) + (s2)) * stbi__f2f(0.353553391f); \
+   int e1 = ((s0) - (s2)) * stbi__f2f(0.353553391f); \
+   int o0 = (s1) * stbi__f2f(0.461939766f) + (s3) * stbi__f2f(0.191341716f); \
+   int o1 = (s1) * stbi__f2f(0.191341716f) - (s3) * stbi__f2f(0.461939766f);
+
+static void stbi__idct_block_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+   int i,val[16],*v=val;
+   short *d = data;
+
+   // columns; scale back down by 1<<12 so the row pass can't overflow
+   for (i=0; i < 4; ++i,++d,++v) {
+      STBI__IDCT_4(d[0],d[8],d[16],d[24])
+      v[ 0] = (e0+o0+2048) >> 12;
+      v[ 4] = (e1+o1+2048) >> 12;
+      v[ 8] = (e1-o1+2048) >> 12;
+      v[12] = (e0-o0+2048) >> 12;
+   }
+
+   for (i=0, v=val; i < 4; ++i,v+=4,out+=out_stride) {
+      STBI__IDCT_4(v[0],v[1],v[2],v[3])
+      // round, and add 128 to map -128..127 onto 0..255, before dropping the 1<<12
+      e0 += 2048 + (128<<12);
+      e1 += 2048 + (128<<12);
+      out[0] = stbi__clamp((e0+o0) >> 12);
+      out[1] = stbi__clamp((e1+o1) >> 12);
+      out[2] = stbi__clamp((e1-o1) >> 12);
+      out[3] = stbi__clamp((e0-o0) >> 12);
+   }
+}
+
+static void stbi__idct_block_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+   // (cos(pi/4)/2)^2 == 1/8
+   int a = data[0] + 4 + (128<<3), b = data[1], c = data[8], d = data[9];
+   out[0]            = stbi__clamp((a + b + c + d) >> 3);
+   out[1]            = stbi__clamp((a - b + c - d) >> 3);
+   out[out_stride+0] = stbi__clamp((a + b - c - d) >> 3);
+   out[out_stride+1] = stbi__clamp((a - b - c + d) >> 3);
+}
+
+static void stbi__idct_block_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+   STBI_NOTUSED(out_stride);
+   out[0] = stbi__clamp((data[0] + 4 + (128<<3)) >> 3);
+}
+
 #ifdef STBI_SSE2
 // sse2 integer IDCT. not the fastest possible implementation but it
 // produces bit-identical results to the generic C version so it's
@@ -2964,7 +3180,7 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                int ha = z->img_comp[n].ha;
                if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*z->block_size+i*z->block_size, z->img_comp[n].w2, data);
                // every data block is an MCU, so countdown the restart interval
                if (--z->todo <= 0) {
                   if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
@@ -2988,8 +3204,8 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
                   // by the basic H and V specified for the component
                   for (y=0; y < z->img_comp[n].v; ++y) {
                      for (x=0; x < z->img_comp[n].h; ++x) {
-                        int x2 = (i*z->img_comp[n].h + x)*8;
-                        int y2 = (j*z->img_comp[n].v + y)*8;
+                        int x2 = (i*z->img_comp[n].h + x)*z->block_size;
+                        int y2 = (j*z->img_comp[n].v + y)*z->block_size;
                         int ha = z->img_comp[n].ha;
                         if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
                         z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
@@ -3070,6 +3286,137 @@ static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
    }
 }
 
+// decode and IDCT MCU (i,j) of a baseline scan: one block for a single-component
+// scan, otherwise every block of every component in the scan
+static int stbi__jpeg_decode_mcu(stbi__jpeg *z, short *data, int i, int j)
+{
+   int k,x,y;
+   if (z->scan_n == 1) {
+      int n = z->order[0];
+      int ha = z->img_comp[n].ha;
+      if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+      z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*z->block_size+i*z->block_size, z->img_comp[n].w2, data);
+      return 1;
+   }
+   for (k=0; k < z->scan_n; ++k) {
+      int n = z->order[k];
+      for (y=0; y < z->img_comp[n].v; ++y) {
+         for (x=0; x < z->img_comp[n].h; ++x) {
+            int x2 = (i*z->img_comp[n].h + x)*z->block_size;
+            int y2 = (j*z->img_comp[n].v + y)*z->block_size;
+            int ha = z->img_comp[n].ha;
+            if (!stbi__jpeg_decode_block(z, data, z->huff_dc+z->img_comp[n].hd, z->huff_ac+ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+            z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*y2+x2, z->img_comp[n].w2, data);
+         }
+      }
+   }
+   return 1;
+}
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi_uc **seg_start, **seg_end; // entropy-coded bytes of each restart interval
+   int segments, tasks;
+   int mcus_per_row, mcu_count;
+   stbi__atomic_flag failed;
+} stbi__jpeg_parallel_scan;
+
+// each task decodes a contiguous run of restart intervals with its own copy
+// of the decoder state; the intervals write disjoint blocks of the planes
+static void stbi__jpeg_parallel_scan_task(void *task_data, int index)
+{
+   stbi__jpeg_parallel_scan *p = (stbi__jpeg_parallel_scan *) task_data;
+   int first = index * p->segments / p->tasks;
+   int last = (index+1) * p->segments / p->tasks;
+   int seg, mcu;
+   STBI_SIMD_ALIGN(short, data[64]);
+   stbi__context s = *p->z->s;
+   stbi__jpeg *z = (stbi__jpeg *) stbi__malloc(sizeof(stbi__jpeg));
+   if (!z) { p->failed = 1; return; }
+   memcpy(z, p->z, sizeof(stbi__jpeg));
+   z->s = &s;
+
+   for (seg = first; seg < last && !p->failed; ++seg) {
+      int mcu_end = (seg+1) * z->restart_interval;
+      if (mcu_end > p->mcu_count) mcu_end = p->mcu_count;
+      // reads past the end of the interval return 0, as for a truncated file
+      s.img_buffer = p->seg_start[seg];
+      s.img_buffer_end = p->seg_end[seg];
+      stbi__jpeg_reset(z);
+      for (mcu = seg * z->restart_interval; mcu < mcu_end; ++mcu) {
+         if (!stbi__jpeg_decode_mcu(z, data, mcu % p->mcus_per_row, mcu / p->mcus_per_row)) {
+            p->failed = 1;
+            break;
+         }
+      }
+   }
+   STBI_FREE(z);
+}
+
+// returns 1 if the scan was decoded across threads, leaving the stream at the
+// marker that ends it; returns 0 with the stream untouched to fall back to
+// stbi__parse_entropy_coded_data (including for anything that looks corrupt)
+static int stbi__jpeg_parallel_scan_data(stbi__jpeg *z)
+{
+   stbi__jpeg_parallel_scan p;
+   stbi__context *s = z->s;
+   stbi_uc *c, *end;
+   int n = z->order[0], rows, expected, too_many = 0;
+
+   if (!stbi__parallel_for || z->progressive || z->restart_interval <= 0 || s->read_from_callbacks)
+      return 0;
+   if ((double) s->img_x * s->img_y < STBI_PARALLEL_MIN_PIXELS)
+      return 0;
+
+   if (z->scan_n == 1) {
+      p.mcus_per_row = (z->img_comp[n].x+7) >> 3;
+      rows = (z->img_comp[n].y+7) >> 3;
+   } else {
+      p.mcus_per_row = z->img_mcu_x;
+      rows = z->img_mcu_y;
+   }
+   p.mcu_count = p.mcus_per_row * rows;
+   expected = (p.mcu_count + z->restart_interval - 1) / z->restart_interval;
+   if (expected < 2) return 0;
+
+   p.seg_start = (stbi_uc **) stbi__malloc_mad2(expected, 2 * sizeof(stbi_uc *), 0);
+   if (!p.seg_start) return 0;
+   p.seg_end = p.seg_start + expected;
+
+   // split the entropy-coded data at RSTn markers; 0xff00 is a stuffed byte,
+   // 0xffff fill, and any other marker ends the scan
+   c = s->img_buffer;
+   end = s->img_buffer_end;
+   p.segments = 1;
+   p.seg_start[0] = c;
+   while (c + 1 < end) {
+      c = (stbi_uc *) memchr(c, 0xff, end - c - 1);
+      if (!c) { c = end; break; }
+      if (c[1] == 0x00 || c[1] == 0xff) { ++c; continue; }
+      if (!STBI__RESTART(c[1])) break;
+      if (p.segments == expected) { too_many = 1; break; }
+      p.seg_end[p.segments-1] = c;
+      p.seg_start[p.segments++] = c + 2;
+      c += 2;
+   }
+   if (c + 1 >= end) c = end;
+   p.seg_end[p.segments-1] = c;
+   if (p.segments != expected || too_many) { STBI_FREE(p.seg_start); return 0; }
+
+   p.z = z;
+   p.tasks = p.segments < 256 ? p.segments : 256;
+   p.failed = 0;
+   stbi__parallel_for(stbi__parallel_for_user, stbi__jpeg_parallel_scan_task, &p, p.tasks);
+   STBI_FREE(p.seg_start);
+   if (p.failed) return 0;
+
+   // the caller's marker search resumes at the marker ending the scan
+   s->img_buffer = c;
+   z->marker = STBI__MARKER_none;
+   return 1;
+}
+
 static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
 {
    int i;
@@ -3089,7 +3436,7 @@ static void stbi__jpeg_finish(stbi__jpeg *z)
             for (i=0; i < w; ++i) {
                short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
                stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*8+i*8, z->img_comp[n].w2, data);
+               z->idct_block_kernel(z->img_comp[n].data+z->img_comp[n].w2*j*z->block_size+i*z->block_size, z->img_comp[n].w2, data);
             }
          }
       }
@@ -3329,8 +3676,11 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       //
       // img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
       // so these muls can't overflow with 32-bit ints (which we require)
-      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+      //
+      // when decoding at a reduced scale each block only produces block_size^2
+      // pixels, but the coefficients (progressive) are still stored in full
+      z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * z->block_size;
+      z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * z->block_size;
       z->img_comp[i].coeff = 0;
       z->img_comp[i].raw_coeff = 0;
       z->img_comp[i].linebuf = NULL;
@@ -3340,10 +3690,10 @@ static int stbi__process_frame_header(stbi__jpeg *z, int scan)
       // align blocks for idct using mmx/sse
       z->img_comp[i].data = (stbi_uc*) (((size_t) z->img_comp[i].raw_data + 15) & ~15);
       if (z->progressive) {
-         // w2, h2 are multiples of 8 (see above)
-         z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-         z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
+         // w2, h2 are multiples of block_size (see above)
+         z->img_comp[i].coeff_w = z->img_comp[i].w2 / z->block_size;
+         z->img_comp[i].coeff_h = z->img_comp[i].h2 / z->block_size;
+         z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15);
          if (z->img_comp[i].raw_coeff == NULL)
             return stbi__free_jpeg_components(z, i+1, stbi__err("outofmem", "Out of memory"));
          z->img_comp[i].coeff = (short*) (((size_t) z->img_comp[i].raw_coeff + 15) & ~15);
@@ -3422,7 +3772,7 @@ static int stbi__decode_jpeg_image(stbi__jpeg *j)
    while (!stbi__EOI(m)) {
       if (stbi__SOS(m)) {
          if (!stbi__process_scan_header(j)) return 0;
-         if (!stbi__parse_entropy_coded_data(j)) return 0;
+         if (!stbi__jpeg_parallel_scan_data(j) && !stbi__parse_entropy_coded_data(j)) return 0;
          if (j->marker == STBI__MARKER_none ) {
          j->marker = stbi__skip_jpeg_junk_at_end(j);
             // if we reach eof without hitting a marker, stbi__get_marker() below will fail and we'll eventually return 0
@@ -3837,6 +4187,11 @@ static void stbi__setup_jpeg(stbi__jpeg *j)
    j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
    j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
 #endif
+
+   j->block_size = 8 >> j->scale_shift;
+   if      (j->scale_shift == 1) j->idct_block_kernel = stbi__idct_block_4x4;
+   else if (j->scale_shift == 2) j->idct_block_kernel = stbi__idct_block_2x2;
+   else if (j->scale_shift == 3) j->idct_block_kernel = stbi__idct_block_1x1;
 }
 
 // clean up the temporary component buffers
@@ -3862,6 +4217,189 @@ static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
    return (stbi_uc) ((t + (t >>8)) >> 8);
 }
 
+// resample and colour-convert output rows [y0,y1), with the resamplers
+// positioned at row y0 (see stbi__resample_seek). 3-channel rows are written
+// 4 bytes per pixel, spilling one byte into the next row; when that row
+// belongs to another thread, last_row receives row y1-1 instead
+static void stbi__jpeg_convert_rows(stbi__jpeg *z, stbi__resample *res_comp, stbi_uc **linebuf, stbi_uc *output,
+                                    int n, int decode_n, int is_rgb, unsigned int y0, unsigned int y1, stbi_uc *last_row)
+{
+   int k;
+   unsigned int i,j;
+   stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
+   for (j=y0; j < y1; ++j) {
+      stbi_uc *out = (last_row && j == y1-1) ? last_row : output + n * z->s->img_x * j;
+      for (k=0; k < decode_n; ++k) {
+         stbi__resample *r = &res_comp[k];
+         int y_bot = r->ystep >= (r->vs >> 1);
+         coutput[k] = r->resample(linebuf[k],
+                                  y_bot ? r->line1 : r->line0,
+                                  y_bot ? r->line0 : r->line1,
+                                  r->w_lores, r->hs);
+         if (++r->ystep >= r->vs) {
+            r->ystep = 0;
+            r->line0 = r->line1;
+            if (++r->ypos < z->img_comp[k].y)
+               r->line1 += z->img_comp[k].w2;
+         }
+      }
+      if (n >= 3) {
+         stbi_uc *y = coutput[0];
+         if (z->s->img_n == 3) {
+            if (is_rgb) {
+               for (i=0; i < z->s->img_x; ++i) {
+                  out[0] = y[i];
+                  out[1] = coutput[1][i];
+                  out[2] = coutput[2][i];
+                  out[3] = 255;
+                  out += n;
+               }
+            } else {
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else if (z->s->img_n == 4) {
+            if (z->app14_color_transform == 0) { // CMYK
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(coutput[0][i], m);
+                  out[1] = stbi__blinn_8x8(coutput[1][i], m);
+                  out[2] = stbi__blinn_8x8(coutput[2][i], m);
+                  out[3] = 255;
+                  out += n;
+               }
+            } else if (z->app14_color_transform == 2) { // YCCK
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+               for (i=0; i < z->s->img_x; ++i) {
+                  stbi_uc m = coutput[3][i];
+                  out[0] = stbi__blinn_8x8(255 - out[0], m);
+                  out[1] = stbi__blinn_8x8(255 - out[1], m);
+                  out[2] = stbi__blinn_8x8(255 - out[2], m);
+                  out += n;
+               }
+            } else { // YCbCr + alpha?  Ignore the fourth channel for now
+               z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
+            }
+         } else
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = out[1] = out[2] = y[i];
+               out[3] = 255; // not used if n==3
+               out += n;
+            }
+      } else {
+         if (is_rgb) {
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i)
+                  *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+            else {
+               for (i=0; i < z->s->img_x; ++i, out += 2) {
+                  out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+                  out[1] = 255;
+               }
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
+            for (i=0; i < z->s->img_x; ++i) {
+               stbi_uc m = coutput[3][i];
+               stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+               stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+               stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+               out[0] = stbi__compute_y(r, g, b);
+               out[1] = 255;
+               out += n;
+            }
+         } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
+            for (i=0; i < z->s->img_x; ++i) {
+               out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+               out[1] = 255;
+               out += n;
+            }
+         } else {
+            stbi_uc *y = coutput[0];
+            if (n == 1)
+               for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
+            else
+               for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
+         }
+      }
+   }
+}
+
+// put a resampler in the state it reaches after emitting 'rows' output rows:
+// ystep starts at vs>>1 and every vs rows moves line1 down one input row
+// (clamped to the last), with line0 taking line1's previous value
+static void stbi__resample_seek(stbi__resample *r, stbi_uc *data, int w2, int comp_y, int rows)
+{
+   int t = (r->vs >> 1) + rows;
+   int wraps = t / r->vs;
+   r->ystep = t % r->vs;
+   r->ypos  = wraps;
+   r->line1 = data + w2 * (wraps < comp_y-1 ? wraps : comp_y-1);
+   r->line0 = wraps ? data + w2 * (wraps-1 < comp_y-1 ? wraps-1 : comp_y-1) : data;
+}
+
+typedef struct
+{
+   stbi__jpeg *z;
+   stbi__resample *res_comp;
+   stbi_uc *output;
+   int n, decode_n, is_rgb;
+   int exact; // output has no spare byte after the last row
+   int rows_per_band;
+   stbi__atomic_flag failed;
+} stbi__jpeg_parallel_convert_job;
+
+static void stbi__jpeg_parallel_convert_task(void *task_data, int index)
+{
+   stbi__jpeg_parallel_convert_job *p = (stbi__jpeg_parallel_convert_job *) task_data;
+   stbi__jpeg *z = p->z;
+   stbi__resample res_comp[4];
+   stbi_uc *linebuf[4];
+   int k, y0 = index * p->rows_per_band, y1 = y0 + p->rows_per_band;
+   // each band needs its own line buffers for upsampling, plus a row to
+   // convert its last row into (see stbi__jpeg_convert_rows)
+   size_t row_size = (size_t) p->n * z->s->img_x;
+   stbi_uc *lines = (stbi_uc *) stbi__malloc_mad2(p->decode_n + 4, z->s->img_x + 3, 0);
+   stbi_uc *last_row = NULL;
+   if (!lines) { p->failed = 1; return; }
+   if (y1 > (int) z->s->img_y) y1 = z->s->img_y;
+   if (p->n == 3 && (y1 < (int) z->s->img_y || p->exact)) last_row = lines + p->decode_n * (z->s->img_x + 3);
+
+   for (k=0; k < p->decode_n; ++k) {
+      res_comp[k] = p->res_comp[k];
+      stbi__resample_seek(&res_comp[k], z->img_comp[k].data, z->img_comp[k].w2, z->img_comp[k].y, y0);
+      linebuf[k] = lines + k * (z->s->img_x + 3);
+   }
+   stbi__jpeg_convert_rows(z, res_comp, linebuf, p->output, p->n, p->decode_n, p->is_rgb, y0, y1, last_row);
+   if (last_row)
+      memcpy(p->output + row_size * (y1-1), last_row, row_size);
+   STBI_FREE(lines);
+}
+
+// returns 0 to have the caller convert serially
+static int stbi__jpeg_parallel_convert(stbi__jpeg *z, stbi__resample *res_comp, stbi_uc *output, int n, int decode_n, int is_rgb, int exact)
+{
+   stbi__jpeg_parallel_convert_job p;
+   int bands;
+   if (!stbi__parallel_for || (double) z->s->img_x * z->s->img_y < STBI_PARALLEL_MIN_PIXELS)
+      return 0;
+
+   // bands of at least 32 rows keep the per-band setup negligible
+   bands = z->s->img_y / 32;
+   if (bands > 256) bands = 256;
+   if (bands < 2) return 0;
+
+   p.z = z;
+   p.res_comp = res_comp;
+   p.output = output;
+   p.n = n;
+   p.decode_n = decode_n;
+   p.is_rgb = is_rgb;
+   p.exact = exact;
+   p.rows_per_band = (z->s->img_y + bands - 1) / bands;
+   p.failed = 0;
+   stbi__parallel_for(stbi__parallel_for_user, stbi__jpeg_parallel_convert_task, &p, (z->s->img_y + p.rows_per_band - 1) / p.rows_per_band);
+   return !p.failed;
+}
+
 static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
 {
    int n, decode_n, is_rgb;
@@ -3873,6 +4411,18 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
    // load a jpeg image from whichever source, but leave in YCbCr format
    if (!stbi__decode_jpeg_image(z)) { stbi__cleanup_jpeg(z); return NULL; }
 
+   // from here on the image is its scaled size; the component planes were
+   // decoded at block_size per block, so scale their effective sizes to match
+   if (z->scale_shift) {
+      int round = (1 << z->scale_shift) - 1;
+      z->s->img_x = (z->s->img_x + round) >> z->scale_shift;
+      z->s->img_y = (z->s->img_y + round) >> z->scale_shift;
+      for (n=0; n < z->s->img_n; ++n) {
+         z->img_comp[n].x = (z->img_comp[n].x + round) >> z->scale_shift;
+         z->img_comp[n].y = (z->img_comp[n].y + round) >> z->scale_shift;
+      }
+   }
+
    // determine actual number of components to generate
    n = req_comp ? req_comp : z->s->img_n >= 3 ? 3 : 1;
 
@@ -3889,10 +4439,8 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
 
    // resample and color-convert
    {
-      int k;
-      unsigned int i,j;
+      int k, exact;
       stbi_uc *output;
-      stbi_uc *coutput[4] = { NULL, NULL, NULL, NULL };
 
       stbi__resample res_comp[4];
 
@@ -3919,102 +4467,26 @@ static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp
       }
 
       // can't error after this so, this is safe
-      output = (stbi_uc *) stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
+      output = (stbi_uc *) stbi__malloc_output_mad3(n, z->s->img_x, z->s->img_y, 1);
       if (!output) { stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
+      exact = stbi__is_output_buffer(output);
 
       // now go ahead and resample
-      for (j=0; j < z->s->img_y; ++j) {
-         stbi_uc *out = output + n * z->s->img_x * j;
-         for (k=0; k < decode_n; ++k) {
-            stbi__resample *r = &res_comp[k];
-            int y_bot = r->ystep >= (r->vs >> 1);
-            coutput[k] = r->resample(z->img_comp[k].linebuf,
-                                     y_bot ? r->line1 : r->line0,
-                                     y_bot ? r->line0 : r->line1,
-                                     r->w_lores, r->hs);
-            if (++r->ystep >= r->vs) {
-               r->ystep = 0;
-               r->line0 = r->line1;
-               if (++r->ypos < z->img_comp[k].y)
-                  r->line1 += z->img_comp[k].w2;
-            }
+      if (!stbi__jpeg_parallel_convert(z, res_comp, output, n, decode_n, is_rgb, exact)) {
+         stbi_uc *linebuf[4];
+         stbi_uc *last_row = NULL;
+         for (k=0; k < decode_n; ++k)
+            linebuf[k] = z->img_comp[k].linebuf;
+         // the caller's buffer ends right after the last row, so convert that
+         // row aside (see stbi__jpeg_convert_rows)
+         if (exact && n == 3) {
+            last_row = (stbi_uc *) stbi__malloc_mad2(n, z->s->img_x, 1);
+            if (!last_row) { stbi__free_output(output); stbi__cleanup_jpeg(z); return stbi__errpuc("outofmem", "Out of memory"); }
          }
-         if (n >= 3) {
-            stbi_uc *y = coutput[0];
-            if (z->s->img_n == 3) {
-               if (is_rgb) {
-                  for (i=0; i < z->s->img_x; ++i) {
-                     out[0] = y[i];
-                     out[1] = coutput[1][i];
-                     out[2] = coutput[2][i];
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else {
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else if (z->s->img_n == 4) {
-               if (z->app14_color_transform == 0) { // CMYK
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(coutput[0][i], m);
-                     out[1] = stbi__blinn_8x8(coutput[1][i], m);
-                     out[2] = stbi__blinn_8x8(coutput[2][i], m);
-                     out[3] = 255;
-                     out += n;
-                  }
-               } else if (z->app14_color_transform == 2) { // YCCK
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-                  for (i=0; i < z->s->img_x; ++i) {
-                     stbi_uc m = coutput[3][i];
-                     out[0] = stbi__blinn_8x8(255 - out[0], m);
-                     out[1] = stbi__blinn_8x8(255 - out[1], m);
-                     out[2] = stbi__blinn_8x8(255 - out[2], m);
-                     out += n;
-                  }
-               } else { // YCbCr + alpha?  Ignore the fourth channel for now
-                  z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-               }
-            } else
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = out[1] = out[2] = y[i];
-                  out[3] = 255; // not used if n==3
-                  out += n;
-               }
-         } else {
-            if (is_rgb) {
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i)
-                     *out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-               else {
-                  for (i=0; i < z->s->img_x; ++i, out += 2) {
-                     out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-                     out[1] = 255;
-                  }
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 0) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  stbi_uc m = coutput[3][i];
-                  stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-                  stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-                  stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-                  out[0] = stbi__compute_y(r, g, b);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else if (z->s->img_n == 4 && z->app14_color_transform == 2) {
-               for (i=0; i < z->s->img_x; ++i) {
-                  out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-                  out[1] = 255;
-                  out += n;
-               }
-            } else {
-               stbi_uc *y = coutput[0];
-               if (n == 1)
-                  for (i=0; i < z->s->img_x; ++i) out[i] = y[i];
-               else
-                  for (i=0; i < z->s->img_x; ++i) { *out++ = y[i]; *out++ = 255; }
-            }
+         stbi__jpeg_convert_rows(z, res_comp, linebuf, output, n, decode_n, is_rgb, 0, z->s->img_y, last_row);
+         if (last_row) {
+            memcpy(output + (size_t) n * z->s->img_x * (z->s->img_y-1), last_row, (size_t) n * z->s->img_x);
+            STBI_FREE(last_row);
          }
       }
       stbi__cleanup_jpeg(z);
@@ -4033,6 +4505,7 @@ static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int re
    memset(j, 0, sizeof(stbi__jpeg));
    STBI_NOTUSED(ri);
    j->s = s;
+   j->scale_shift = stbi__jpeg_scale_on_load;
    stbi__setup_jpeg(j);
    result = load_jpeg_image(j, x,y,comp,req_comp);
    STBI_FREE(j);
@@ -4306,9 +4779,151 @@ static const int stbi__zdist_base[32] = { 1,2,3,4,5,7,9,13,17,25,33,49,65,97,129
 static const int stbi__zdist_extra[32] =
 { 0,0,0,0,1,1,2,2,3,3,4,4,5,5,6,6,7,7,8,8,9,9,10,10,11,11,12,12,13,13};
 
-static int stbi__parse_huffman_block(stbi__zbuf *a)
+// fast inflate: while at least 8 input bytes and a maximal match of output
+// space remain, decode from a 64-bit bit buffer refilled a word at a time,
+// through 10-bit tables whose entries already carry the length/distance base
+// and extra-bit count. one refill covers a whole length/distance pair
+// (15+5+15+13 bits). the last few bytes of a block go through the original
+// byte-at-a-time loop. benchmarks clear stbi__fast_png to compare against it
+static int stbi__fast_png = 1;
+
+#define STBI__ZFAST32_BITS  10
+#define STBI__ZFAST32_MASK  ((1 << STBI__ZFAST32_BITS) - 1)
+#define STBI__ZFAST32_LITERAL  0x100
+#define STBI__ZFAST32_END      0x200
+#define STBI__ZFAST32_INVALID  0x400
+
+typedef unsigned long long stbi__zbits;
+
+// table entry: code length in bits 0-3, extra bits in 4-7, flags, value/base in 16-31
+static stbi__uint32 stbi__zfast32_entry(int sym, int len, int is_distance)
+{
+   if (is_distance) {
+      if (sym >= 30) return len | STBI__ZFAST32_INVALID;
+      return len | (stbi__zdist_extra[sym] << 4) | ((stbi__uint32) stbi__zdist_base[sym] << 16);
+   }
+   if (sym < 256) return len | STBI__ZFAST32_LITERAL | ((stbi__uint32) sym << 16);
+   if (sym == 256) return len | STBI__ZFAST32_END;
+   if (sym >= 286) return len | STBI__ZFAST32_INVALID;
+   return len | (stbi__zlength_extra[sym-257] << 4) | ((stbi__uint32) stbi__zlength_base[sym-257] << 16);
+}
+
+static void stbi__zbuild_fast32(stbi__uint32 *table, stbi__zhuffman *z, int is_distance)
+{
+   int s,c,j;
+   memset(table, 0, sizeof(stbi__uint32) << STBI__ZFAST32_BITS);
+   for (s=1; s <= STBI__ZFAST32_BITS; ++s) {
+      int count = (z->maxcode[s] >> (16-s)) - z->firstcode[s];
+      for (c=0; c < count; ++c) {
+         int idx = z->firstsymbol[s] + c;
+         stbi__uint32 e;
+         if (idx >= STBI__ZNSYMS || z->size[idx] != s) continue;
+         e = stbi__zfast32_entry(z->value[idx], s, is_distance);
+         for (j = stbi__bit_reverse(z->firstcode[s] + c, s); j < (1 << STBI__ZFAST32_BITS); j += (1 << s))
+            table[j] = e;
+      }
+   }
+}
+
+// codes longer than the table: same canonical search as the slow path
+static stbi__uint32 stbi__zfast32_long(stbi__zhuffman *z, stbi__zbits bits, int is_distance)
+{
+   int b,s,k = stbi__bit_reverse((int) (bits & 0xffff), 16);
+   for (s=STBI__ZFAST32_BITS+1; ; ++s)
+      if (k < z->maxcode[s])
+         break;
+   if (s >= 16) return STBI__ZFAST32_INVALID;
+   b = (k >> (16-s)) - z->firstcode[s] + z->firstsymbol[s];
+   if (b >= STBI__ZNSYMS || z->size[b] != s) return STBI__ZFAST32_INVALID;
+   return stbi__zfast32_entry(z->value[b], s, is_distance);
+}
+
+// returns 1 at the end of the block, 0 on error, 2 when the margins run out
+static int stbi__parse_huffman_block_fast(stbi__zbuf *a)
 {
+   stbi__uint32 lit[1 << STBI__ZFAST32_BITS], dist[1 << STBI__ZFAST32_BITS];
+   stbi__zbits bitbuf = a->code_buffer;
+   int bits = a->num_bits;
+   stbi_uc *in = a->zbuffer;
    char *zout = a->zout;
+   int result = 2;
+
+   stbi__zbuild_fast32(lit, &a->z_length, 0);
+   stbi__zbuild_fast32(dist, &a->z_distance, 1);
+
+   while (a->zbuffer_end - in >= 8 && a->zout_end - zout >= 258 + 8) {
+      stbi__zbits word;
+      stbi__uint32 e;
+      int len, d;
+      stbi_uc *p;
+
+      // top up to 56..63 bits; bytes only partly taken are loaded again next time
+      memcpy(&word, in, 8);
+      #if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+      word = __builtin_bswap64(word);
+      #endif
+      bitbuf |= word << bits;
+      in += (63 - bits) >> 3;
+      bits |= 56;
+
+      e = lit[bitbuf & STBI__ZFAST32_MASK];
+      if (!(e & 15)) e = stbi__zfast32_long(&a->z_length, bitbuf, 0);
+      if (e & STBI__ZFAST32_INVALID) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+      bitbuf >>= e & 15;
+      bits -= e & 15;
+      if (e & STBI__ZFAST32_LITERAL) {
+         *zout++ = (char) (e >> 16);
+         continue;
+      }
+      if (e & STBI__ZFAST32_END) { result = 1; break; }
+
+      len = (e >> 16) + (int) (bitbuf & ((1 << ((e >> 4) & 15)) - 1));
+      bitbuf >>= (e >> 4) & 15;
+      bits -= (e >> 4) & 15;
+
+      e = dist[bitbuf & STBI__ZFAST32_MASK];
+      if (!(e & 15)) e = stbi__zfast32_long(&a->z_distance, bitbuf, 1);
+      if (e & STBI__ZFAST32_INVALID) { result = stbi__err("bad huffman code","Corrupt PNG"); break; }
+      bitbuf >>= e & 15;
+      bits -= e & 15;
+      d = (e >> 16) + (int) (bitbuf & ((1 << ((e >> 4) & 15)) - 1));
+      bitbuf >>= (e >> 4) & 15;
+      bits -= (e >> 4) & 15;
+
+      if (zout - a->zout_start < d) { result = stbi__err("bad dist","Corrupt PNG"); break; }
+      p = (stbi_uc *) (zout - d);
+      if (d >= 8) {
+         // 8-byte chunks never overlap their own source; may write up to 7 bytes past len
+         char *end = zout + len;
+         do { memcpy(zout, p, 8); zout += 8; p += 8; } while (zout < end);
+         zout = end;
+      } else if (d == 1) {
+         memset(zout, *p, len);
+         zout += len;
+      } else {
+         do *zout++ = *p++; while (--len);
+      }
+   }
+
+   // hand whole unread bytes back to the input so the slow path can carry on
+   in -= bits >> 3;
+   bits &= 7;
+   a->zbuffer = in;
+   a->code_buffer = (stbi__uint32) (bitbuf & ((1u << bits) - 1));
+   a->num_bits = bits;
+   a->zout = zout;
+   return result;
+}
+
+static int stbi__parse_huffman_block(stbi__zbuf *a)
+{
+   char *zout;
+   // building the 10-bit tables costs more than it saves on tiny streams
+   if (stbi__fast_png && !a->hit_zeof_once && a->zbuffer_end - a->zbuffer >= 256) {
+      int r = stbi__parse_huffman_block_fast(a);
+      if (r != 2) return r;
+   }
+   zout = a->zout;
    for(;;) {
       int z = stbi__zhuffman_decode(a, &a->z_length);
       if (z < 256) {
@@ -4667,6 +5282,94 @@ static int stbi__paeth(int a, int b, int c)
    return t1;
 }
 
+#ifdef STBI_SSE2
+// sse2 unfilters for 3- and 4-byte pixels (8-bit RGB/RGBA), after libpng's
+// filter_sse2_intrinsics.c. sub/avg/paeth depend on the pixel to the left, so
+// they run a pixel at a time but on the whole pixel at once; up is 16 bytes
+// at a time. 3-byte pixels are moved as 4 bytes, so the last pixel of a row
+// (whose 4th byte belongs to the next row) is left to the scalar loop
+static __m128i stbi__png_load_pixel(const stbi_uc *p)
+{
+   int v;
+   memcpy(&v, p, 4);
+   return _mm_cvtsi32_si128(v);
+}
+
+static void stbi__png_store_pixel(stbi_uc *p, __m128i v, int bpp)
+{
+   int x = _mm_cvtsi128_si32(v);
+   memcpy(p, &x, bpp);
+}
+
+static __m128i stbi__png_if_then_else(__m128i c, __m128i t, __m128i e)
+{
+   return _mm_or_si128(_mm_and_si128(c, t), _mm_andnot_si128(c, e));
+}
+
+// returns the number of bytes of cur it filled in; the caller does the rest
+static int stbi__png_unfilter_sse2(int filter, stbi_uc *cur, const stbi_uc *raw, const stbi_uc *prior, int nk, int bpp)
+{
+   const __m128i zero = _mm_setzero_si128();
+   int k = 0;
+   if (!stbi__sse2_available()) return 0;
+   if (filter == STBI__F_up) {
+      for (; k + 16 <= nk; k += 16) {
+         __m128i x = _mm_loadu_si128((const __m128i *) (raw + k));
+         __m128i b = _mm_loadu_si128((const __m128i *) (prior + k));
+         _mm_storeu_si128((__m128i *) (cur + k), _mm_add_epi8(x, b));
+      }
+      return k;
+   }
+   if (bpp != 3 && bpp != 4) return 0;
+   switch (filter) {
+   case STBI__F_sub: {
+      __m128i a = zero;
+      for (; k + 4 <= nk; k += bpp) {
+         a = _mm_add_epi8(a, stbi__png_load_pixel(raw + k));
+         stbi__png_store_pixel(cur + k, a, bpp);
+      }
+      break;
+   }
+   case STBI__F_avg: {
+      const __m128i one = _mm_set1_epi8(1);
+      __m128i a = zero;
+      for (; k + 4 <= nk; k += bpp) {
+         __m128i b = stbi__png_load_pixel(prior + k);
+         // floor((a+b)/2): _mm_avg_epu8 rounds up, so drop the odd bit
+         __m128i avg = _mm_sub_epi8(_mm_avg_epu8(a, b), _mm_and_si128(_mm_xor_si128(a, b), one));
+         a = _mm_add_epi8(avg, stbi__png_load_pixel(raw + k));
+         stbi__png_store_pixel(cur + k, a, bpp);
+      }
+      break;
+   }
+   case STBI__F_paeth: {
+      __m128i a = zero, c = zero;
+      for (; k + 4 <= nk; k += bpp) {
+         __m128i b = _mm_unpacklo_epi8(stbi__png_load_pixel(prior + k), zero);
+         __m128i pa = _mm_sub_epi16(b, c);
+         __m128i pb = _mm_sub_epi16(a, c);
+         __m128i pc = _mm_add_epi16(pa, pb);
+         __m128i smallest;
+         pa = _mm_max_epi16(pa, _mm_sub_epi16(zero, pa));
+         pb = _mm_max_epi16(pb, _mm_sub_epi16(zero, pb));
+         pc = _mm_max_epi16(pc, _mm_sub_epi16(zero, pc));
+         smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+         // ties prefer a, then b, as in the PNG spec
+         c = stbi__png_if_then_else(_mm_cmpeq_epi16(smallest, pa), a,
+             stbi__png_if_then_else(_mm_cmpeq_epi16(smallest, pb), b, c));
+         a = _mm_unpacklo_epi8(_mm_add_epi8(_mm_packus_epi16(c, c), stbi__png_load_pixel(raw + k)), zero);
+         stbi__png_store_pixel(cur + k, _mm_packus_epi16(a, a), bpp);
+         c = b;
+      }
+      break;
+   }
+   default:
+      return 0;
+   }
+   return k;
+}
+#endif
+
 static const stbi_uc stbi__depth_scale_table[9] = { 0, 0xff, 0x55, 0, 0x11, 0,0,0, 0x01 };
 
 // adds an extra all-255 alpha channel
@@ -4709,7 +5412,11 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
    int width = x;
 
    STBI_ASSERT(out_n == s->img_n || out_n == s->img_n+1);
-   a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0); // extra bytes to write off the end into
+   // paletted images are expanded into a new buffer afterwards, so only that one is a result
+   if (color == 3)
+      a->out = (stbi_uc *) stbi__malloc_mad3(x, y, output_bytes, 0);
+   else
+      a->out = (stbi_uc *) stbi__malloc_output_mad3(x, y, output_bytes, 0);
    if (!a->out) return stbi__err("outofmem", "Out of memory");
 
    // note: error exits here don't need to clean up a->out individually,
@@ -4751,6 +5458,27 @@ static int stbi__create_png_image_raw(stbi__png *a, stbi_uc *raw, stbi__uint32 r
       // if first row, use special filter that doesn't sample previous row
       if (j == 0) filter = first_row_filter[filter];
 
+#ifdef STBI_SSE2
+      if (stbi__fast_png && depth == 8 && filter != STBI__F_none && filter != STBI__F_avg_first) {
+         // finish whatever the vector loop left with the scalar filters below,
+         // which need the pixel to the left (already in cur) from here on
+         int done = stbi__png_unfilter_sse2(filter, cur, raw, prior, nk, filter_bytes);
+         if (done > 0) {
+            for (k = done; k < nk; ++k) {
+               int left = k >= filter_bytes ? cur[k-filter_bytes] : 0;
+               int up_left = k >= filter_bytes ? prior[k-filter_bytes] : 0;
+               switch (filter) {
+               case STBI__F_sub:   cur[k] = STBI__BYTECAST(raw[k] + left); break;
+               case STBI__F_up:    cur[k] = STBI__BYTECAST(raw[k] + prior[k]); break;
+               case STBI__F_avg:   cur[k] = STBI__BYTECAST(raw[k] + ((prior[k] + left) >> 1)); break;
+               case STBI__F_paeth: cur[k] = STBI__BYTECAST(raw[k] + stbi__paeth(left, prior[k], up_left)); break;
+               }
+            }
+            filter = -1; // done
+         }
+      }
+#endif
+
       // perform actual filtering
       switch (filter) {
       case STBI__F_none:
@@ -4868,7 +5596,10 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       return stbi__create_png_image_raw(a, image_data, image_data_len, out_n, a->s->img_x, a->s->img_y, depth, color);
 
    // de-interlacing
-   final = (stbi_uc *) stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
+   if (color == 3)
+      final = (stbi_uc *) stbi__malloc_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
+   else
+      final = (stbi_uc *) stbi__malloc_output_mad3(a->s->img_x, a->s->img_y, out_bytes, 0);
    if (!final) return stbi__err("outofmem", "Out of memory");
    for (p=0; p < 7; ++p) {
       int xorig[] = { 0,4,0,2,0,1,0 };
@@ -4882,7 +5613,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
       if (x && y) {
          stbi__uint32 img_len = ((((a->s->img_n * x * depth) + 7) >> 3) + 1) * y;
          if (!stbi__create_png_image_raw(a, image_data, image_data_len, out_n, x, y, depth, color)) {
-            STBI_FREE(final);
+            stbi__free_output(final);
             return 0;
          }
          for (j=0; j < y; ++j) {
@@ -4893,7 +5624,7 @@ static int stbi__create_png_image(stbi__png *a, stbi_uc *image_data, stbi__uint3
                       a->out + (j*x+i)*out_bytes, out_bytes);
             }
          }
-         STBI_FREE(a->out);
+         stbi__free_output(a->out);
          image_data += img_len;
          image_data_len -= img_len;
       }
@@ -4958,7 +5689,7 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
    stbi__uint32 i, pixel_count = a->s->img_x * a->s->img_y;
    stbi_uc *p, *temp_out, *orig = a->out;
 
-   p = (stbi_uc *) stbi__malloc_mad2(pixel_count, pal_img_n, 0);
+   p = (stbi_uc *) stbi__malloc_output_mad3(pixel_count, pal_img_n, 1, 0);
    if (p == NULL) return stbi__err("outofmem", "Out of memory");
 
    // between here and free(out) below, exitting would leak
@@ -4982,7 +5713,7 @@ static int stbi__expand_png_palette(stbi__png *a, stbi_uc *palette, int len, int
          p += 4;
       }
    }
-   STBI_FREE(a->out);
+   stbi__free_output(a->out);
    a->out = temp_out;
 
    STBI_NOTUSED(len);
@@ -5285,9 +6016,9 @@ static void *stbi__do_png(stbi__png *p, int *x, int *y, int *n, int req_comp, st
       *y = p->s->img_y;
       if (n) *n = p->s->img_n;
    }
-   STBI_FREE(p->out);      p->out      = NULL;
-   STBI_FREE(p->expanded); p->expanded = NULL;
-   STBI_FREE(p->idata);    p->idata    = NULL;
+   stbi__free_output(p->out); p->out      = NULL;
+   STBI_FREE(p->expanded);    p->expanded = NULL;
+   STBI_FREE(p->idata);       p->idata    = NULL;
 
    return result;
 }
@@ -7078,6 +7809,76 @@ static int stbi__gif_info(stbi__context *s, int *x, int *y, int *comp)
 {
    return stbi__gif_info_raw(s,x,y,comp);
 }
+
+struct stbi_gif_stream
+{
+   stbi__context s;
+   stbi__gif g;
+   stbi_uc const *buffer;
+   int len;
+};
+
+static void stbi__gif_stream_reset(stbi_gif_stream *g)
+{
+   STBI_FREE(g->g.out);
+   STBI_FREE(g->g.history);
+   STBI_FREE(g->g.background);
+   memset(&g->g, 0, sizeof(g->g));
+   stbi__start_mem(&g->s, g->buffer, g->len);
+}
+
+STBIDEF stbi_gif_stream *stbi_gif_stream_open(stbi_uc const *buffer, int len, int *x, int *y)
+{
+   stbi__context s;
+   stbi_gif_stream *g;
+   stbi__start_mem(&s, buffer, len);
+   if (!stbi__gif_test(&s))
+      return (stbi_gif_stream *) stbi__errpuc("not GIF", "Corrupt GIF");
+   if (!stbi__gif_info_raw(&s, x, y, NULL))
+      return NULL;
+   g = (stbi_gif_stream *) stbi__malloc(sizeof(stbi_gif_stream));
+   if (!g)
+      return (stbi_gif_stream *) stbi__errpuc("outofmem", "Out of memory");
+   memset(g, 0, sizeof(*g));
+   g->buffer = buffer;
+   g->len = len;
+   stbi__gif_stream_reset(g);
+   return g;
+}
+
+STBIDEF int stbi_gif_stream_next(stbi_gif_stream *g, stbi_uc *output, int flip, int *delay_ms)
+{
+   int comp, row, stride, h;
+   // disposal 3 restores the canvas as it was just before the previous frame
+   // was drawn, which is the snapshot stbi__gif_load_next keeps in background
+   // (stbi__load_gif_main's frame n-2 is the composited output, not that)
+   stbi_uc *u = stbi__gif_load_next(&g->s, &g->g, &comp, 4, g->g.background);
+   if (u == (stbi_uc *) &g->s)
+      return 0;
+   if (!u)
+      return -1;
+
+   stride = g->g.w * 4;
+   h = g->g.h;
+   for (row = 0; row < h; ++row)
+      memcpy(output + (size_t) row * stride, u + (size_t) (flip ? h - 1 - row : row) * stride, stride);
+   if (delay_ms) *delay_ms = g->g.delay;
+   return 1;
+}
+
+STBIDEF void stbi_gif_stream_rewind(stbi_gif_stream *g)
+{
+   stbi__gif_stream_reset(g);
+}
+
+STBIDEF void stbi_gif_stream_close(stbi_gif_stream *g)
+{
+   if (!g) return;
+   STBI_FREE(g->g.out);
+   STBI_FREE(g->g.history);
+   STBI_FREE(g->g.background);
+   STBI_FREE(g);
+}
 #endif
 
 // *************************************************************************************************
@@ -0,0 +1,151 @@
+// Converts an image into a block-compressed .ctex texture (see blockCompress.h).
+//
+//   texconv [-f bc1|bc3|bc7|etc2] [-m] [-v] in.png out.ctex
+//
+//   -f  block format (default: bc1 for opaque images, bc3 otherwise)
+//   -m  store a full mip chain
+//   -v  flip vertically, matching SetFlipImagesOnLoad(true)
+
+#define STBI_FAILURE_USERMSG
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "blockCompress.h"
+#include "mipmap.h"
+#include "threadPool.h"
+
+#include <string>
+#include <vector>
+using namespace std;
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void WriteBytes(FILE* out, const void* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, out) != size) {
+        perror("fwrite");
+        exit(errno);
+    }
+}
+
+BlockFormat ParseBlockFormat(const char* name) {
+    if (strcmp(name, "bc1") == 0) return BLOCK_BC1;
+    if (strcmp(name, "bc3") == 0) return BLOCK_BC3;
+    if (strcmp(name, "bc7") == 0) return BLOCK_BC7;
+    if (strcmp(name, "etc2") == 0) return BLOCK_ETC2_RGB;
+    fprintf(stderr, "unknown block format %s\n", name);
+    exit(1);
+}
+
+bool HasTransparency(const unsigned char* rgba, int w, int h) {
+    for (size_t i = 0; i < (size_t)w*h; ++i) {
+        if (rgba[i*4 + 3] != 255) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    BlockFormat format = BLOCK_NONE;
+    bool mipmaps = false;
+    bool flip = false;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        if (strcmp(argv[arg], "-f") == 0 && arg + 1 < argc) {
+            format = ParseBlockFormat(argv[++arg]);
+        } else if (strcmp(argv[arg], "-m") == 0) {
+            mipmaps = true;
+        } else if (strcmp(argv[arg], "-v") == 0) {
+            flip = true;
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[arg]);
+            return 1;
+        }
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: %s [-f bc1|bc3|bc7|etc2] [-m] [-v] in.png out.ctex\n", argv[0]);
+        return 1;
+    }
+
+    const char* inPath = argv[arg];
+    const char* outPath = argv[arg + 1];
+
+    stbi_set_flip_vertically_on_load(flip);
+    int w, h, channels;
+    unsigned char* pixels = stbi_load(inPath, &w, &h, &channels, 4);
+    if (!pixels) {
+        fprintf(stderr, "%s: %s\n", inPath, stbi_failure_reason());
+        return 1;
+    }
+
+    if (format == BLOCK_NONE) {
+        format = HasTransparency(pixels, w, h) ? BLOCK_BC3 : BLOCK_BC1;
+    }
+
+    int levels = mipmaps ? MipLevelCount(w, h) : 1;
+    vector<unsigned char> chain(MipChainSize(w, h, 4, levels));
+    memcpy(chain.data(), pixels, MipLevelSize(w, h, 4, 0));
+    stbi_image_free(pixels);
+    GenerateMipChain(chain.data(), w, h, 4, levels);
+
+    CompressedTextureHeader header = {};
+    header.magic = COMPRESSED_TEXTURE_MAGIC;
+    header.version = COMPRESSED_TEXTURE_VERSION;
+    header.format = format;
+    header.w = w;
+    header.h = h;
+    header.levels = levels;
+    header.flags = flip ? (uint32_t)COMPRESSED_TEXTURE_FLIPPED_VERTICALLY : 0;
+
+    // Levels are packed back to back after a 16-byte aligned start, so the
+    // loader can address them like an uncompressed mip chain.
+    vector<CompressedTextureLevel> levelTable(levels);
+    uint64_t offset = (sizeof(header) + levels*sizeof(CompressedTextureLevel) + 15) & ~(uint64_t)15;
+    for (int level = 0; level < levels; ++level) {
+        levelTable[level].offset = offset;
+        levelTable[level].size = CompressedLevelSize(format, MipDimension(w, level), MipDimension(h, level));
+        offset += levelTable[level].size;
+    }
+
+    // Block rows are independent, so each level is split across the pool.
+    vector<unsigned char> blocks(offset);
+    {
+        ThreadPool pool(thread::hardware_concurrency());
+        vector<future<void>> jobs;
+        for (int level = 0; level < levels; ++level) {
+            int lw = MipDimension(w, level), lh = MipDimension(h, level);
+            const unsigned char* src = chain.data() + MipLevelOffset(w, h, 4, level);
+            unsigned char* dst = blocks.data() + levelTable[level].offset;
+            int blockRows = (lh + 3)/4;
+            for (int row = 0; row < blockRows; row += 8) {
+                int lastRow = row + 8 < blockRows ? row + 8 : blockRows;
+                jobs.push_back(pool.Submit([=] { EncodeBlockRows(format, src, lw, lh, row, lastRow, dst); }));
+            }
+        }
+        for (auto& job : jobs) {
+            job.get();
+        }
+    }
+
+    memcpy(blocks.data(), &header, sizeof(header));
+    memcpy(blocks.data() + sizeof(header), levelTable.data(), levels*sizeof(CompressedTextureLevel));
+
+    FILE* out = fopen(outPath, "wb");
+    if (out == nullptr) {
+        perror("fopen");
+        exit(errno);
+    }
+    WriteBytes(out, blocks.data(), blocks.size());
+    if (fclose(out) == EOF) {
+        perror("fclose");
+        exit(errno);
+    }
+
+    size_t rawSize = MipChainSize(w, h, channels == 4 ? 4 : 3, levels);
+    printf("%s: %dx%d, %d level(s), %zu -> %zu bytes\n", outPath, w, h, levels, rawSize, blocks.size());
+    return 0;
+}
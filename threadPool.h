@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Fixed set of worker threads draining a shared queue of jobs, highest
+// priority first and FIFO within a priority. Submit returns a std::future so
+// callers can block on (or poll) individual results; ParallelFor splits one
+// job's loop across the pool.
+struct ThreadPool {
+    struct Job {
+        int priority;
+        uint64_t sequence;
+        std::function<void()> run;
+
+        // Heap order: lower priority, then later submission, sinks.
+        bool operator<(Job const& other) const {
+            return priority != other.priority ? priority < other.priority : sequence > other.sequence;
+        }
+    };
+
+    // ParallelFor helpers: the thread that queued them is already waiting.
+    static constexpr int PRIORITY_PARALLEL_FOR = INT_MAX;
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::vector<Job> jobs; // binary heap, see Job::operator<
+    uint64_t submitted = 0;
+    bool stopping = false;
+
+    explicit ThreadPool(unsigned count = DefaultWorkerCount()) {
+        for (unsigned i = 0; i < count; ++i) {
+            workers.emplace_back([this] { WorkerLoop(); });
+        }
+    }
+
+    ThreadPool(ThreadPool const&) = delete;
+    ThreadPool& operator=(ThreadPool const&) = delete;
+
+    // Finishes the jobs already queued before joining.
+    ~ThreadPool() {
+        {
+            std::lock_guard lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+
+    // Leaves one core for the GL thread.
+    static unsigned DefaultWorkerCount() {
+        unsigned cores = std::thread::hardware_concurrency();
+        return cores > 1 ? cores - 1 : 1;
+    }
+
+    // Call with mutex held.
+    void Push(int priority, std::function<void()> run) {
+        jobs.push_back({priority, submitted++, std::move(run)});
+        std::push_heap(jobs.begin(), jobs.end());
+    }
+
+    template <class F>
+    auto Submit(F&& f, int priority = 0) -> std::future<std::invoke_result_t<F>> {
+        using Result = std::invoke_result_t<F>;
+        auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<F>(f));
+        std::future<Result> result = task->get_future();
+        {
+            std::lock_guard lock(mutex);
+            Push(priority, [task] { (*task)(); });
+        }
+        wake.notify_one();
+        return result;
+    }
+
+    // Runs body(i) for every i in [0, count) on the workers and the calling
+    // thread, returning once all of them have finished. The caller claims
+    // indices too, so a job may call this without deadlocking a busy pool.
+    template <class F>
+    void ParallelFor(int count, F&& body) {
+        struct Progress {
+            std::atomic<int> next{0}, done{0};
+            std::mutex mutex;
+            std::condition_variable finished;
+        };
+        // Helpers that only start after everything is done still read the counter.
+        auto progress = std::make_shared<Progress>();
+        auto work = [progress, count, fn = &body] {
+            int done = 0;
+            for (int i; (i = progress->next++) < count; ++done) {
+                (*fn)(i);
+            }
+            if (done > 0 && progress->done.fetch_add(done) + done == count) {
+                std::lock_guard lock(progress->mutex);
+                progress->finished.notify_all();
+            }
+        };
+
+        int helpers = std::min<int>(count - 1, (int)workers.size());
+        if (helpers > 0) {
+            {
+                std::lock_guard lock(mutex);
+                for (int i = 0; i < helpers; ++i) {
+                    Push(PRIORITY_PARALLEL_FOR, work);
+                }
+            }
+            wake.notify_all();
+        }
+
+        work();
+        std::unique_lock lock(progress->mutex);
+        progress->finished.wait(lock, [&] { return progress->done == count; });
+    }
+
+    void WorkerLoop() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock lock(mutex);
+                wake.wait(lock, [this] { return stopping || !jobs.empty(); });
+                if (jobs.empty()) {
+                    return;
+                }
+                std::pop_heap(jobs.begin(), jobs.end());
+                job = std::move(jobs.back().run);
+                jobs.pop_back();
+            }
+            job();
+        }
+    }
+};
+
+template <class Result>
+bool IsReady(std::future<Result> const& f) {
+    return f.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Tiled image pyramids for virtual texturing, for images larger than
+// GL_MAX_TEXTURE_SIZE. tilebuilder cuts an image and each of its 2x2
+// box-filtered levels (see mipmap.h) into square tiles, each stored as its
+// own QOI stream so the viewer can decode exactly the tiles it needs on pool
+// workers. The coarsest level fits in a single tile.
+//
+// .tiles layout:
+//
+//   TilePyramidHeader
+//   TilePyramidLevel[levels]  finest first
+//   TilePyramidTile[tiles]    level by level, row-major within a level
+//   QOI tile data
+//
+// Every tile is tileSize pixels square: border pixels copied from its
+// neighbours (clamped at the image edges) around tileSize - 2*border pixels
+// of its own, so bilinear filtering stays seamless once the tiles are
+// scattered across a cache texture.
+
+#define TILE_PYRAMID_MAGIC   0x454c4954u // "TILE"
+#define TILE_PYRAMID_VERSION 1u
+
+#define TILE_PYRAMID_DEFAULT_TILE_SIZE 128
+#define TILE_PYRAMID_DEFAULT_BORDER    1
+
+struct TilePyramidHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t w, h;      // level 0
+    uint32_t tileSize;  // including the border on both sides
+    uint32_t border;
+    uint32_t channels;  // 3 or 4
+    uint32_t levels;
+};
+
+struct TilePyramidLevel {
+    uint32_t w, h;
+    uint32_t tilesX, tilesY;
+    uint64_t firstTile; // index into the tile table
+};
+
+struct TilePyramidTile {
+    uint64_t offset; // from the start of the file
+    uint64_t size;
+};
+
+// Pixels of its own per tile edge. Kept even so tile (x, y) of one level is
+// exactly covered by tile (x/2, y/2) of the next.
+int TileContentSize(int tileSize, int border) {
+    return tileSize - 2*border;
+}
+
+int TileCount(int size, int content) {
+    return (size + content - 1)/content;
+}
+
+// Levels down to the first one that fits in a single tile.
+int TilePyramidLevelCount(int w, int h, int content) {
+    int levels = 1;
+    while (w > content || h > content) {
+        w = w > 1 ? w/2 : 1;
+        h = h > 1 ? h/2 : 1;
+        ++levels;
+    }
+    return levels;
+}
@@ -0,0 +1,179 @@
+// Cuts an image into a tiled pyramid (.tiles, see tilePyramid.h) for the
+// virtual texture viewer (main image.tiles).
+//
+//   tilebuilder [-t tileSize] [-b border] in.png out.tiles
+//
+//   -t  tile size in pixels, border included (default 128)
+//   -b  border pixels copied from neighbouring tiles (default 1)
+
+#define STBI_FAILURE_USERMSG
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "mipmap.h"
+#include "qoi.h"
+#include "threadPool.h"
+#include "tilePyramid.h"
+
+#include <vector>
+using namespace std;
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+void WriteBytes(FILE* out, const void* data, size_t size) {
+    if (size > 0 && fwrite(data, 1, size, out) != size) {
+        perror("fwrite");
+        exit(errno);
+    }
+}
+
+// Copies tile (tx, ty) with its border out of one level, clamping at the edges.
+void CutTile(const unsigned char* level, int w, int h, int channels, int tx, int ty, int tileSize, int border,
+             unsigned char* tile) {
+    int content = TileContentSize(tileSize, border);
+    int x0 = tx*content - border, y0 = ty*content - border;
+    for (int y = 0; y < tileSize; ++y) {
+        int sy = y0 + y < 0 ? 0 : (y0 + y >= h ? h - 1 : y0 + y);
+        const unsigned char* row = level + (size_t)sy*w*channels;
+        unsigned char* dst = tile + (size_t)y*tileSize*channels;
+        for (int x = 0; x < tileSize; ++x) {
+            int sx = x0 + x < 0 ? 0 : (x0 + x >= w ? w - 1 : x0 + x);
+            memcpy(dst + x*channels, row + (size_t)sx*channels, channels);
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int tileSize = TILE_PYRAMID_DEFAULT_TILE_SIZE;
+    int border = TILE_PYRAMID_DEFAULT_BORDER;
+
+    int arg = 1;
+    for (; arg < argc && argv[arg][0] == '-'; ++arg) {
+        if (strcmp(argv[arg], "-t") == 0 && arg + 1 < argc) {
+            tileSize = atoi(argv[++arg]);
+        } else if (strcmp(argv[arg], "-b") == 0 && arg + 1 < argc) {
+            border = atoi(argv[++arg]);
+        } else {
+            fprintf(stderr, "unknown option %s\n", argv[arg]);
+            return 1;
+        }
+    }
+    if (argc - arg != 2) {
+        fprintf(stderr, "usage: %s [-t tileSize] [-b border] in.png out.tiles\n", argv[0]);
+        return 1;
+    }
+    int content = TileContentSize(tileSize, border);
+    if (border < 0 || content < 2 || content % 2 != 0 || tileSize > 4096) {
+        fprintf(stderr, "tile size %d with border %d: need an even, positive content size\n", tileSize, border);
+        return 1;
+    }
+
+    const char* inPath = argv[arg];
+    const char* outPath = argv[arg + 1];
+
+    // Tiles are RGB or RGBA (the cache texture is RGBA8 either way).
+    int w, h, channels;
+    if (!stbi_info(inPath, &w, &h, &channels)) {
+        fprintf(stderr, "%s: %s\n", inPath, stbi_failure_reason());
+        return 1;
+    }
+    channels = (channels == 2 || channels == 4) ? 4 : 3;
+    unsigned char* pixels = stbi_load(inPath, &w, &h, nullptr, channels);
+    if (!pixels) {
+        fprintf(stderr, "%s: %s\n", inPath, stbi_failure_reason());
+        return 1;
+    }
+
+    TilePyramidHeader header = {};
+    header.magic = TILE_PYRAMID_MAGIC;
+    header.version = TILE_PYRAMID_VERSION;
+    header.w = w;
+    header.h = h;
+    header.tileSize = tileSize;
+    header.border = border;
+    header.channels = channels;
+    header.levels = TilePyramidLevelCount(w, h, content);
+
+    vector<TilePyramidLevel> levelTable(header.levels);
+    uint64_t tileCount = 0;
+    for (uint32_t level = 0; level < header.levels; ++level) {
+        TilePyramidLevel& l = levelTable[level];
+        l.w = MipDimension(w, level);
+        l.h = MipDimension(h, level);
+        l.tilesX = TileCount(l.w, content);
+        l.tilesY = TileCount(l.h, content);
+        l.firstTile = tileCount;
+        tileCount += (uint64_t)l.tilesX*l.tilesY;
+    }
+    vector<TilePyramidTile> tileTable(tileCount);
+
+    FILE* out = fopen(outPath, "wb");
+    if (out == nullptr) {
+        perror("fopen");
+        exit(errno);
+    }
+
+    // Tile data goes after the tables, which are written last once the
+    // offsets are known. Only two levels are held in memory at a time.
+    uint64_t offset = sizeof(header) + levelTable.size()*sizeof(TilePyramidLevel) + tileTable.size()*sizeof(TilePyramidTile);
+    vector<unsigned char> tablePlaceholder(offset);
+    WriteBytes(out, tablePlaceholder.data(), tablePlaceholder.size());
+
+    size_t encodedSize = 0;
+    ThreadPool pool(thread::hardware_concurrency());
+    vector<unsigned char> level(pixels, pixels + (size_t)w*h*channels);
+    stbi_image_free(pixels);
+    for (uint32_t levelIndex = 0; levelIndex < header.levels; ++levelIndex) {
+        TilePyramidLevel const& l = levelTable[levelIndex];
+
+        // One job per tile row; rows are written in order as they finish.
+        vector<future<vector<vector<unsigned char>>>> rows;
+        for (uint32_t ty = 0; ty < l.tilesY; ++ty) {
+            rows.push_back(pool.Submit([&, ty] {
+                vector<vector<unsigned char>> encoded(l.tilesX);
+                vector<unsigned char> tile((size_t)tileSize*tileSize*channels);
+                for (uint32_t tx = 0; tx < l.tilesX; ++tx) {
+                    CutTile(level.data(), l.w, l.h, channels, tx, ty, tileSize, border, tile.data());
+                    encoded[tx] = QoiEncode(tile.data(), tileSize, tileSize, channels);
+                }
+                return encoded;
+            }));
+        }
+        for (uint32_t ty = 0; ty < l.tilesY; ++ty) {
+            vector<vector<unsigned char>> encoded = rows[ty].get();
+            for (uint32_t tx = 0; tx < l.tilesX; ++tx) {
+                TilePyramidTile& tile = tileTable[l.firstTile + (uint64_t)ty*l.tilesX + tx];
+                tile.offset = offset;
+                tile.size = encoded[tx].size();
+                WriteBytes(out, encoded[tx].data(), encoded[tx].size());
+                offset += tile.size;
+                encodedSize += tile.size;
+            }
+        }
+
+        if (levelIndex + 1 < header.levels) {
+            vector<unsigned char> next((size_t)MipDimension(l.w, 1)*MipDimension(l.h, 1)*channels);
+            DownsampleLevel(level.data(), l.w, l.h, next.data(), channels);
+            level = std::move(next);
+        }
+    }
+
+    if (fseek(out, 0, SEEK_SET) != 0) {
+        perror("fseek");
+        exit(errno);
+    }
+    WriteBytes(out, &header, sizeof(header));
+    WriteBytes(out, levelTable.data(), levelTable.size()*sizeof(TilePyramidLevel));
+    WriteBytes(out, tileTable.data(), tileTable.size()*sizeof(TilePyramidTile));
+    if (fclose(out) == EOF) {
+        perror("fclose");
+        exit(errno);
+    }
+
+    printf("%s: %dx%d, %u level(s), %llu tiles of %d px, %zu bytes of tile data\n", outPath, w, h, header.levels,
+           (unsigned long long)tileCount, tileSize, encodedSize);
+    return 0;
+}
@@ -0,0 +1,38 @@
+#version 400 core
+
+layout(location = 0) out vec4 color;
+
+in vec2 vTexel;
+
+uniform sampler2D uCache;     // resident tiles, borders included
+uniform sampler2D uPageTable; // per tile of each level: cache slot x, y and the level actually in it
+uniform ivec2 uPageOffsets[32]; // where each level's entries start in uPageTable
+uniform ivec2 uPageCounts[32];  // tiles per level
+uniform int uLevels;
+uniform vec2 uImageSize;
+uniform vec3 uTile; // tile size, border, cache texture size (pixels)
+
+void main() {
+    if (any(lessThan(vTexel, vec2(0.0))) || any(greaterThanEqual(vTexel, uImageSize))) {
+        discard;
+    }
+    float tileSize = uTile.x;
+    float border = uTile.y;
+    float content = tileSize - 2.0 * border;
+
+    // Same choice as VirtualTextureLevelFor, which decides what gets loaded.
+    vec2 dx = dFdx(vTexel);
+    vec2 dy = dFdy(vTexel);
+    float texelsPerPixel = sqrt(max(dot(dx, dx), dot(dy, dy)));
+    int level = min(int(floor(log2(max(texelsPerPixel, 1.0)))), uLevels - 1);
+
+    ivec2 page = clamp(ivec2(vTexel / (content * exp2(float(level)))), ivec2(0), uPageCounts[level] - 1);
+    vec4 entry = floor(texelFetch(uPageTable, uPageOffsets[level] + page, 0) * 255.0 + 0.5);
+
+    // A missing tile's entry points at the ancestor standing in for it.
+    int mapped = int(entry.b);
+    ivec2 mappedPage = page >> (mapped - level);
+    vec2 inTile = clamp(vTexel / exp2(float(mapped)) - vec2(mappedPage) * content, vec2(0.0), vec2(content));
+    vec2 cacheTexel = entry.rg * tileSize + border + inTile;
+    color = texture(uCache, cacheTexel / uTile.z);
+}
@@ -0,0 +1,16 @@
+#version 400 core
+
+// One triangle covering the viewport; vTexel is the level-0 image pixel
+// under each fragment for the pan/zoom in uViewOrigin and uViewScale.
+out vec2 vTexel;
+
+uniform vec2 uViewOrigin; // image pixel at the top-left corner of the viewport
+uniform float uViewScale; // image pixels per framebuffer pixel
+uniform vec2 uViewport;
+
+void main() {
+  vec2 position = vec2((gl_VertexID & 1) * 4.0 - 1.0, (gl_VertexID & 2) * 2.0 - 1.0);
+  gl_Position = vec4(position, 0.0, 1.0);
+  vec2 pixel = (position * 0.5 + 0.5) * uViewport;
+  vTexel = uViewOrigin + vec2(pixel.x, uViewport.y - pixel.y) * uViewScale;
+}